@@ -0,0 +1,151 @@
+// boottrace: prints the boot timeline that init recorded in boot.trace
+// as a per-service Gantt chart, followed by the critical path through
+// the dependency graph.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+#include "user/boottrace.h"
+
+#define NAME_COLS 12             // Width of the service name column
+#define CHART_COLS 50            // Width of the chart
+
+struct trace_header hdr;
+struct trace_service *svcs;
+
+// Prints s left-aligned in a field of width columns
+void
+pad(char *s, int width)
+{
+  int n = strlen(s);
+  printf("%s", s);
+  for(; n < width; n++)
+    printf(" ");
+}
+
+// Maps a tick to a chart column
+int
+column(int tick)
+{
+  int span = hdr.boot_done - hdr.parse_start;
+  if(span <= 0)
+    span = 1;
+  int c = (tick - hdr.parse_start) * CHART_COLS / span;
+  if(c < 0)
+    c = 0;
+  if(c >= CHART_COLS)
+    c = CHART_COLS - 1;
+  return c;
+}
+
+// One chart row: '=' from fork until the service finished or became
+// ready, '-' while it kept running afterwards.
+void
+chart_row(struct trace_service *s)
+{
+  char row[CHART_COLS + 1];
+  int start = column(s->fork_tick);
+  int done = s->done_tick < 0 ? CHART_COLS : column(s->done_tick);
+  int end = s->exit_tick < 0 ? CHART_COLS : column(s->exit_tick);
+
+  for(int c = 0; c < CHART_COLS; c++){
+    if(c < start)
+      row[c] = ' ';
+    else if(c <= done)
+      row[c] = '=';
+    else if(c <= end)
+      row[c] = '-';
+    else
+      row[c] = ' ';
+  }
+  row[CHART_COLS] = 0;
+  printf("|%s|", row);
+}
+
+void
+print_timeline(void)
+{
+  printf("boot: %d ticks (config ready after %d)\n",
+         hdr.boot_done - hdr.parse_start, hdr.config_ready - hdr.parse_start);
+  for(int i = 0; i < hdr.service_count; i++){
+    struct trace_service *s = &svcs[i];
+    pad(s->name, NAME_COLS);
+    if(s->fork_tick < 0){
+      printf("not started\n");
+      continue;
+    }
+    chart_row(s);
+    printf(" fork %d", s->fork_tick - hdr.parse_start);
+    if(s->exec_tick >= 0)
+      printf(" exec %d", s->exec_tick - hdr.parse_start);
+    if(s->done_tick >= 0)
+      printf(" done %d", s->done_tick - hdr.parse_start);
+    if(s->exit_tick >= 0)
+      printf(" exit %d", s->exit_tick - hdr.parse_start);
+    printf("\n");
+  }
+}
+
+// The critical path ends at the service that finished last; each step
+// back goes to the dependency that finished last, since that is the one
+// that held the service back.
+void
+print_critical_path(void)
+{
+  int *path = malloc(sizeof(int) * (hdr.service_count + 1));
+  int len = 0;
+  int cur = -1;
+
+  for(int i = 0; i < hdr.service_count; i++)
+    if(svcs[i].done_tick >= 0 && (cur < 0 || svcs[i].done_tick > svcs[cur].done_tick))
+      cur = i;
+  while(cur >= 0 && len < hdr.service_count){
+    path[len++] = cur;
+    int next = -1;
+    for(int d = 0; d < svcs[cur].dep_count; d++){
+      int dep = svcs[cur].deps[d];
+      if(dep < 0 || dep >= hdr.service_count || svcs[dep].done_tick < 0)
+        continue;
+      if(next < 0 || svcs[dep].done_tick > svcs[next].done_tick)
+        next = dep;
+    }
+    cur = next;
+  }
+
+  if(len > 0)
+    printf("critical path:\n");
+  for(int i = len - 1; i >= 0; i--){
+    struct trace_service *s = &svcs[path[i]];
+    printf("  %s: %d ticks (fork %d, done %d)\n", s->name,
+           s->done_tick - s->fork_tick, s->fork_tick - hdr.parse_start,
+           s->done_tick - hdr.parse_start);
+  }
+  free(path);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *file = argc > 1 ? argv[1] : TRACE_FILE;
+  int fd = open(file, O_RDONLY);
+  if(fd < 0){
+    fprintf(2, "boottrace: cannot open %s\n", file);
+    exit(1);
+  }
+  if(read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != TRACE_MAGIC ||
+     hdr.service_count < 0){
+    fprintf(2, "boottrace: %s is not a boot trace\n", file);
+    exit(1);
+  }
+  int size = hdr.service_count * sizeof(struct trace_service);
+  svcs = malloc(size > 0 ? size : 1);
+  if(read(fd, svcs, size) != size){
+    fprintf(2, "boottrace: %s is truncated\n", file);
+    exit(1);
+  }
+  close(fd);
+
+  print_timeline();
+  print_critical_path();
+  exit(0);
+}
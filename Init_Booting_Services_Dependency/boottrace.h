@@ -0,0 +1,27 @@
+// Boot timeline that init writes to TRACE_FILE once every service has
+// finished or reported ready. All times are uptime() ticks.
+
+#define TRACE_FILE "boot.trace"
+#define TRACE_MAGIC 0x63617274   // "trac"
+#define TRACE_NAME 32            // Longer service names are truncated
+#define TRACE_DEPS 8             // Further dependencies are not recorded
+
+// Start of TRACE_FILE, followed by service_count trace_service records
+struct trace_header {
+  uint magic;
+  int service_count;
+  int parse_start;               // init began reading its configuration
+  int config_ready;              // start order known (parsed or loaded from cache)
+  int boot_done;                 // last service finished or became ready
+};
+
+// One record per service, in the order of init's services[] table
+struct trace_service {
+  char name[TRACE_NAME];
+  int fork_tick;                 // -1 if the service was never started
+  int exec_tick;                 // -1 if the child never reached exec()
+  int done_tick;                 // exited, or reported ready; -1 if neither
+  int exit_tick;                 // -1 if still running when boot finished
+  int dep_count;
+  int deps[TRACE_DEPS];          // Indices of dependencies in this file
+};
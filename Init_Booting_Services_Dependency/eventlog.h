@@ -0,0 +1,32 @@
+// Event log that init appends to EVENT_FILE as services start, become
+// ready, exit or are stopped. Every event is one fixed-size record, so
+// logging costs a copy instead of formatting text; initlog turns the
+// records back into text. All times are uptime() ticks.
+
+#define EVENT_FILE "init.events"
+#define EVENT_OLD "init.events.1"   // EVENT_FILE is moved here once it is full
+#define EVENT_MAX (16 * 1024)       // Bytes in EVENT_FILE before it is rotated
+#define EVENT_NOSVC 0xffff          // svc of events not about one service
+
+// Event types
+#define EV_CONFIG 1              // Configuration loaded: svc = service count, status = 1 on reload
+#define EV_NAME 2                // 8 bytes of the name of service svc, in order
+#define EV_START 3               // Service forked
+#define EV_READY 4               // Notify service reported readiness
+#define EV_EXIT 5                // Service process reaped, with its exit status
+#define EV_STOP 6                // Service killed because the configuration changed or at shutdown
+#define EV_FAIL 7                // Service not started: its binary or a dependency's is missing
+#define EV_HALT 8                // Shutdown finished: status = ticks it took, pid = services not stopped
+
+// Services are identified by their index in the configuration of the last
+// EV_CONFIG record, which is followed by the names of all its services.
+// The names are repeated at the start of every file, so each file can be
+// decoded on its own.
+struct event {
+  uint tick;
+  uchar type;                    // EV_*
+  uchar pad;
+  ushort svc;                    // Service index, or EVENT_NOSVC
+  int pid;                       // EV_NAME: these 8 bytes hold the name instead
+  int status;
+};
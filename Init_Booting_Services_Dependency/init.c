@@ -2,316 +2,827 @@
 #include "kernel/stat.h"       // File status definitions
 #include "user/user.h"         // User space system call wrappers
 #include "kernel/fcntl.h"      // File control options for open()
+#include "kernel/fs.h"         // DIRSIZ, the longest file name
+#include "user/boottrace.h"    // Boot timeline file format
+#include "user/eventlog.h"     // Event log file format
+#include "user/initcore.h"     // Parser, dependency graph and scheduler
+#include "user/ctlchan.h"      // Control channel for initctl
 
 // ----------- CONFIGURABLE LIMITS AND CONSTANTS -------------
-#define MAX_SERVICES 32          // Maximum number of distinct services supported
-#define MAX_DEPENDENCIES 8       // Maximum number of dependencies for a service
-#define MAX_NAME 32              // Maximum length for a service name
-#define MAX_LINE 128             // Maximum length for a line in the config file
-#define MAX_CMDS 32              // Maximum number of standalone shell commands in config
-#define MAX_CMD_ARGS 8           // Maximum allowed command-line arguments per service
+#define READY_FD 3               // Fd on which a notify service reports readiness
+#define CONF_FILE "init.conf"    // Text configuration
+#define CACHE_FILE "init.conf.bin" // Compiled form of CONF_FILE
+#define CACHE_MAGIC 0x696e6963   // "inic"
+#define CACHE_VERSION 6
+#define LOG_MAX 4096             // Bytes in a service log before it is rotated
+#define LOG_KEEP 2               // Rotated logs kept per service: <name>.log.1 and .2
+#define EVENT_BUF (BSIZE / sizeof(struct event)) // Events buffered before a write
 
 // ----------- STRUCTURE DEFINITIONS -------------------------
 
-// Structure representing a service definition from the config file
-struct service {
-  char name[MAX_NAME];                          // The unique name of the service (e.g., "S1")
-  char command[MAX_LINE];                       // The command to execute for this service
-  char deps[MAX_DEPENDENCIES][MAX_NAME];        // Names of services this service depends on
-  int dep_count;                                // Number of dependencies this service has
-  int started;                                  // Set to 1 if the service has been started
-  int pid;                                      // Process ID of the service's running process
-};
+struct linereader conf_reader;                  // Block-buffered reader for init.conf
 
-// Structure for commands in the config file that are not services
-struct shellcmd {
-  char line[MAX_LINE];                          // Full command line as a string
-};
+// Boot timeline, see boottrace.h
+struct trace_header boot_trace;
+int exec_pipe[2] = { -1, -1 };                  // Children report their exec tick here
 
-// Arrays to store all parsed services and shell commands
-struct service services[MAX_SERVICES];
-int service_count = 0;                          // Actual number of services parsed
+// State of the control requests (see ctlchan.h) handled after replying
+int reload_pending = 0;                         // Services to start after replying
+int shutdown_pending = 0;                       // Shut down after replying
+int shell_pid = -1;                             // Interactive shell, -1 if not running
+int timer_pid = -1;                             // Last timer started by start_timer()
 
-struct shellcmd shellcmds[MAX_CMDS];
-int shellcmd_count = 0;                         // Actual number of shell commands parsed
+// Status messages go to the console a buffer at a time instead of one
+// write() per character. The buffer is flushed before every fork(), so
+// children start with it empty, and before init blocks in wait(), so
+// messages are never held back while nothing else happens.
+struct bfile console;
 
-// ----------- UTILITY FUNCTIONS -----------------------------
+// Record sent by a service child just before exec()
+struct exec_record {
+  int idx;
+  int tick;
+};
 
-// Trims leading/trailing whitespace and removes newline chars from a string
-void trim(char *s) {
-  int i = 0, j = 0;
-  // Skip leading spaces/tabs
-  while (s[i] == ' ' || s[i] == '\t') i++;
-  // Copy over the buffer, omitting newlines and carriage returns
-  while (s[i]) {
-    if (s[i] != '\n' && s[i] != '\r')
-      s[j++] = s[i];
-    i++;
-  }
-  s[j] = 0;  // Null-terminate the string
-}
+// Header of CACHE_FILE, followed by the first arena_used bytes of the arena
+struct cache_header {
+  uint magic;
+  uint version;
+  uint conf_ino;                                // Inode of CONF_FILE the cache was built from
+  uint64 conf_size;                             // Size of CONF_FILE the cache was built from
+  uint arena_used;                              // Bytes of arena image that follow
+  struct config conf;
+};
 
-// Parses a config file line into a service struct if possible
-// Returns 1 if the line is a service definition, 0 for other lines (e.g., comments or commands)
-int parse_line(char *line, struct service *svc) {
-  trim(line);                                  // Clean up whitespace, newlines
-  if (line[0] == '#' || line[0] == '\0') return 0; // Skip comment/empty lines
-
-  // Find ':' separator for dependencies
-  char *colon = strchr(line, ':');
-  if (!colon) return 0;                        // Not a service definition if missing
-
-  // Find '|' separator for command
-  char *pipe = strchr(line, '|');
-  if (!pipe) return 0;                         // Not a service definition if missing
-
-  // --- Parse service name (left of ':') ---
-  *colon = '\0';                               // Temporarily split string at ':'
-  safestrcpy(svc->name, line, MAX_NAME);       // Copy name to struct
-  char *deps_start = colon + 1;                // Dependencies start after ':'
-
-  // --- Parse dependencies (between ':' and '|') ---
-  *pipe = '\0';                                // Temporarily split string at '|'
-  svc->dep_count = 0;                          // Reset dependency count
-  char *deps = deps_start;
-  trim(deps);
-  if (deps[0] != '\0') {
-    // Tokenize dependencies by spaces
-    char *tok = deps;
-    while (*tok && svc->dep_count < MAX_DEPENDENCIES) {
-      while (*tok == ' ') tok++;
-      if (*tok == '\0') break;
-      char *end = tok;
-      while (*end && *end != ' ') end++;
-      char tmp = *end;
-      *end = '\0';
-      safestrcpy(svc->deps[svc->dep_count++], tok, MAX_NAME); // Add each dependency
-      *end = tmp;
-      tok = end;
+// ----------- EVENT LOG -------------------------------------
+
+// Events are collected in event_buf and appended to EVENT_FILE a block at
+// a time, so recording one costs a copy rather than a write() and a disk
+// log transaction. The buffer is also flushed whenever init is about to
+// wait for children after boot, so the file is current while init is idle.
+// Children never flush, so they cannot write init's events twice.
+struct event event_buf[EVENT_BUF];
+int event_count;
+int event_fd = -1;
+
+// Writes an EV_CONFIG record and the names of all services directly to
+// EVENT_FILE. status is 0 at boot, 1 after a reload, 2 at the start of a
+// new file after rotation.
+void write_config_events(int status) {
+  struct event batch[8];
+  int n = 0;
+  memset(batch, 0, sizeof(batch));
+  batch[n].tick = uptime();
+  batch[n].type = EV_CONFIG;
+  batch[n].svc = service_count;
+  batch[n++].status = status;
+  for (int i = 0; i < service_count; i++) {
+    char *name = svc_name(i);
+    int len = strlen(name);
+    for (int off = 0; off <= len; off += 8) {  // The last piece holds the null
+      if (n == 8) {
+        write(event_fd, batch, sizeof(batch));
+        memset(batch, 0, sizeof(batch));
+        n = 0;
+      }
+      batch[n].tick = batch[0].tick;
+      batch[n].type = EV_NAME;
+      batch[n].svc = i;
+      memmove(&batch[n++].pid, name + off, len - off < 8 ? len - off : 8);
     }
   }
+  write(event_fd, batch, n * sizeof(struct event));
+}
 
-  // --- Parse command (after '|') ---
-  char *cmd = pipe + 1;
-  trim(cmd);                                   // Remove whitespace/newlines
-  safestrcpy(svc->command, cmd, MAX_LINE);     // Save command
-
-  svc->started = 0;                            // Not started yet
-  svc->pid = -1;                               // Not running yet
-
-  return 1;                                    // Successfully parsed a service
+// Appends the buffered events to EVENT_FILE. A full file is moved to
+// EVENT_OLD first, replacing the previous one, so the log never takes
+// more than 2 * EVENT_MAX bytes of disk.
+void flush_events(void) {
+  struct stat st;
+  int n = event_count * sizeof(struct event);
+  event_count = 0;
+  if (n == 0 || event_fd < 0)
+    return;
+  if (fstat(event_fd, &st) == 0 && st.size + n > EVENT_MAX) {
+    close(event_fd);
+    unlink(EVENT_OLD);
+    link(EVENT_FILE, EVENT_OLD);               // xv6 has no rename()
+    unlink(EVENT_FILE);
+    event_fd = open(EVENT_FILE, O_CREATE | O_WRONLY | O_APPEND);
+    if (event_fd < 0)
+      return;
+    write_config_events(2);                    // So the new file names its services
+  }
+  write(event_fd, event_buf, n);
 }
 
-// Reads a line from a file descriptor into a buffer (like fgets)
-// Returns number of chars read, zero at EOF
-int readline(int fd, char *buf, int max) {
-  int i = 0;
-  char c;
-  while(i + 1 < max) {
-    int n = read(fd, &c, 1);                   // Read one character at a time
-    if (n < 1) break;                          // EOF or error
-    buf[i++] = c;
-    if (c == '\n' || c == '\r') break;         // End of line
-  }
-  buf[i] = '\0';                               // Null-terminate
-  return i;
+// Records an event about service svc
+void log_event(int type, int svc, int pid, int status) {
+  if (event_fd < 0)
+    return;
+  struct event *ev = &event_buf[event_count++];
+  ev->tick = uptime();
+  ev->type = type;
+  ev->pad = 0;
+  ev->svc = svc;
+  ev->pid = pid;
+  ev->status = status;
+  if (event_count == EVENT_BUF)
+    flush_events();
 }
 
-// Find the index of a service by name in the services[] array
-int find_service_idx(char *name) {
+// Records that a configuration was loaded (status as for
+// write_config_events()), and which of its services cannot start
+void log_config(int status) {
+  if (event_fd < 0)
+    return;
+  flush_events();                              // Events about the old configuration
+  write_config_events(status);
   for (int i = 0; i < service_count; i++) {
-    if (strncmp(name, services[i].name, MAX_NAME) == 0)
-      return i;
+    if (svc_state[i].state == SVC_FAILED)
+      log_event(EV_FAIL, i, -1, 0);
   }
-  return -1;                                   // Not found
 }
 
-// ----------- CIRCULAR DEPENDENCY DETECTION -----------------
-
-// Recursive helper for cycle detection: returns 1 if a cycle is found
-// Uses Depth First Search (DFS) to explore the dependency graph.
-// visited[]: array marks services already checked to avoid redundant visits.
-// stack[]:   array marks services currently in the recursion stack (current path).
-// If we revisit a node already on the stack, there is a cycle.
-int has_circular_dependency_util(int idx, int *visited, int *stack) {
-  if (!visited[idx]) {
-    visited[idx] = stack[idx] = 1;             // Mark as visited and on the stack (DFS)
-    for (int i = 0; i < services[idx].dep_count; i++) {
-      // This is implicit: for each service, svc->deps[] holds the names of dependencies.
-      // The functions that use this to build a graph are:
-      int dep_idx = find_service_idx(services[idx].deps[i]);
-      if (dep_idx < 0) continue;               // Skip missing dependencies
-      // Recursively check dependencies
-      if (!visited[dep_idx] && has_circular_dependency_util(dep_idx, visited, stack))
-        return 1;                              // Found new cycle deeper in graph
-      else if (stack[dep_idx])
-        return 1;                              // Found back-edge: cycle exists
-    }
-  }
-  stack[idx] = 0;                              // Backtrack: remove from stack
-  return 0;
+// ----------- STARTING SERVICES -----------------------------
+
+// Readiness watcher: runs in its own child so that init can keep blocking in
+// wait(). Exits 0 once the service writes "ready", 1 if the pipe closes first.
+void watch_ready(int fd) {
+  char buf[8];
+  int len = 0, n;
+  while (len < 5 && (n = read(fd, buf + len, 5 - len)) > 0)
+    len += n;
+  exit(len == 5 && strncmp(buf, "ready", 5) == 0 ? 0 : 1);
 }
 
-// Checks if any circular dependencies exist among all services
-// For each service, starts a DFS to look for cycles using has_circular_dependency_util().
-// Returns 1 if a cycle exists, 0 otherwise.
-int has_circular_dependency() {
-  int visited[MAX_SERVICES] = {0};
-  int stack[MAX_SERVICES] = {0};
-  for (int i = 0; i < service_count; i++) {
-    if (has_circular_dependency_util(i, visited, stack)) return 1;
+// Builds the name of a service log: <name>.log, or <name>.log.<gen> for an
+// older one. Returns -1 if that does not fit in DIRSIZ.
+int log_path(char *buf, char *name, int gen) {
+  int len = strlen(name);
+  if (len + 6 > DIRSIZ)                         // ".log.N"
+    return -1;
+  memmove(buf, name, len);
+  memmove(buf + len, ".log", 5);
+  if (gen > 0) {
+    buf[len + 4] = '.';
+    buf[len + 5] = '0' + gen;
+    buf[len + 6] = 0;
   }
   return 0;
 }
 
-// ----------- TOPOLOGICAL SORT (ORDERING SERVICES BY DEPENDENCY) -----------
-
-// Utility for topological sort using DFS
-// visited[]: tracks services already sorted
-// order[]:   filled with sorted indices; services with no dependencies go first
-// pos:       pointer to current position in order[]
-void topological_sort_util(int idx, int *visited, int *order, int *pos) {
-  visited[idx] = 1;
-  // Visit all dependencies before this service
-  for (int i = 0; i < services[idx].dep_count; i++) {
-    int dep_idx = find_service_idx(services[idx].deps[i]);
-    if (dep_idx >= 0 && !visited[dep_idx])
-      topological_sort_util(dep_idx, visited, order, pos);
-  }
-  order[(*pos)++] = idx;                       // Add service after its dependencies
+// Shifts <name>.log to .1, .1 to .2 and so on, dropping the oldest
+void rotate_logs(char *name) {
+  char from[DIRSIZ + 1], to[DIRSIZ + 1];
+  for (int gen = LOG_KEEP; gen > 0; gen--) {
+    log_path(to, name, gen);
+    log_path(from, name, gen - 1);
+    unlink(to);
+    link(from, to);                             // xv6 has no rename()
+    unlink(from);
+  }
 }
 
-// Computes dependency-respecting order of services using topological sort
-// Populates the provided order[] array with service indices
-// The result is that each service appears after all its dependencies.
-void topological_sort(int *order) {
-  int visited[MAX_SERVICES] = {0};
-  int pos = 0;
-  for (int i = 0; i < service_count; i++) {
-    if (!visited[i])
-      topological_sort_util(i, visited, order, &pos);
+// Service logger: runs in its own child and appends whatever the service
+// writes to its stdout and stderr (read from in) to <name>.log. Once the
+// file would grow past LOG_MAX bytes it is rotated, so a service never
+// takes more than (LOG_KEEP + 1) * LOG_MAX bytes of disk. Exits when the
+// service and every process that inherited its output have closed it.
+// The file is only created once the service writes something: each log
+// takes an inode, and mkfs gives the whole file system just NINODES (200),
+// so a silent service must not use one up.
+void run_logger(char *name, int in) {
+  char path[DIRSIZ + 1], buf[512];
+  struct stat st;
+  int fd = -1, size = 0, n;
+  log_path(path, name, 0);
+  while ((n = read(in, buf, sizeof(buf))) > 0) {
+    if (fd < 0) {
+      fd = open(path, O_CREATE | O_WRONLY | O_APPEND);
+      size = fd >= 0 && fstat(fd, &st) == 0 ? st.size : 0;
+    }
+    if (size > 0 && size + n > LOG_MAX) {
+      if (fd >= 0)
+        close(fd);
+      rotate_logs(name);
+      fd = open(path, O_CREATE | O_WRONLY | O_APPEND);
+      size = 0;
+    }
+    if (fd >= 0 && write(fd, buf, n) == n)
+      size += n;                               // Output is dropped if the disk is full
   }
+  exit(0);
 }
-// Tokenizes a command line into argv array for exec()
-// Returns the number of arguments (argc)
-int tokenize_cmd(char *cmd, char *argv[MAX_CMD_ARGS]) {
-  int argc = 0;
-  char *p = cmd;
-  while (*p && argc < MAX_CMD_ARGS - 1) {
-    while (*p == ' ') p++;                      // Skip spaces
-    if (*p == 0) break;
-    argv[argc++] = p;                           // Start of argument
-    while (*p && *p != ' ') p++;                // Find end of argument
-    if (*p) {
-      *p = 0;                                   // Null-terminate argument
-      p++;
+
+// Closes init's private ends of the control pipes and the event log in a
+// child, leaving only CTL_FD so that descendants can send requests
+void close_init_fds(void) {
+  if (event_fd >= 0)
+    close(event_fd);
+  close_control_fds();
+}
+
+// Starts the logger of service idx and returns the write end of its pipe,
+// or -1 if the service has to write to the console instead
+int start_logger(int idx) {
+  char path[DIRSIZ + 1];
+  int p[2];
+  if (log_path(path, svc_name(idx), 0) < 0) {
+    bprintf(&console, "[init] %s: name too long for a log file, output goes to the console\n", svc_name(idx));
+    return -1;
+  }
+  if (pipe(p) < 0)
+    return -1;
+  bflush(&console);
+  int pid = fork();
+  if (pid == 0) {
+    close(p[1]);
+    close_init_fds();
+    if (exec_pipe[0] >= 0) {
+      close(exec_pipe[0]);
+      close(exec_pipe[1]);
     }
+    run_logger(svc_name(idx), p[0]);
   }
-  argv[argc] = 0;                               // Null at end for exec
-  return argc;
+  close(p[0]);
+  if (pid < 0) {
+    close(p[1]);
+    return -1;
+  }
+  svc_state[idx].logger_pid = pid;
+  pid_insert(pid, idx);
+  return p[1];
 }
 
 // Forks and starts a service in a child process, executes its command
-// Records the PID in the service struct and prints status
-void start_service(int idx) {
+// Returns the child's PID, or -1 if the fork failed, and prints status
+// The service's stdout and stderr go to its logger (see run_logger()).
+// Notify services get the write end of a pipe as READY_FD, and a watcher
+// process holding the read end exits when the service reports readiness.
+int start_service(int idx) {
+  int log_fd = start_logger(idx);               // Before any pipe it must not hold
+  int p[2] = { -1, -1 };
+  if (services[idx].notify && pipe(p) < 0) {
+    bprintf(&console, "[init] pipe failed for %s, not waiting for readiness\n", svc_name(idx));
+    p[0] = p[1] = -1;
+  }
+
+  bflush(&console);
   int pid = fork();
   if (pid == 0) {
     // --- Child process --- //
+    close_init_fds();
+    if (log_fd >= 0) {
+      close(1);
+      dup(log_fd);                              // Lowest free fd: stdout
+      close(2);
+      dup(log_fd);                              // Then stderr
+      close(log_fd);
+    }
+    if (p[1] >= 0) {
+      close(p[0]);
+      if (p[1] != READY_FD) {
+        close(READY_FD);
+        dup(p[1]);                              // Lowest free fd: READY_FD
+        close(p[1]);
+      }
+    }
     char *argv[MAX_CMD_ARGS];
-    char cmd_copy[MAX_LINE];
-    safestrcpy(cmd_copy, services[idx].command, MAX_LINE);
-    tokenize_cmd(cmd_copy, argv);               // Build argv array
+    uint *arg_off = AT(services[idx].argv);
+    for (int i = 0; i < services[idx].argc; i++)
+      argv[i] = AT(arg_off[i]);
+    argv[services[idx].argc] = 0;               // Null at end for exec
+
+    if (exec_pipe[1] >= 0) {                    // Report the exec tick to init
+      struct exec_record rec = { idx, uptime() };
+      write(exec_pipe[1], &rec, sizeof(rec));
+      close(exec_pipe[0]);
+      close(exec_pipe[1]);
+    }
 
     if (argv[0] == 0) exit(0);                  // Empty command, do nothing
     exec(argv[0], argv);                        // Replace with service program
     printf("[init] exec %s failed\n", argv[0]); // Should not reach here
     exit(1);
-  } else if (pid > 0) {
+  }
+  if (log_fd >= 0)
+    close(log_fd);                              // Only the service may write
+  if (pid > 0) {
     // --- Parent process --- //
-    services[idx].pid = pid;                    // Save child pid
-    services[idx].started = 1;                  // Mark as started
-    printf("[init] Started %s (PID %d)\n", services[idx].name, pid);
+    bprintf(&console, "[init] Started %s (PID %d)\n", svc_name(idx), pid);
+    log_event(EV_START, idx, pid, 0);
+    if (p[0] >= 0) {
+      close(p[1]);                              // Only the service may write
+      bflush(&console);
+      int wpid = fork();
+      if (wpid == 0)
+        watch_ready(p[0]);
+      if (wpid < 0)
+        bprintf(&console, "[init] Failed to fork readiness watcher for %s\n", svc_name(idx));
+      svc_state[idx].watcher_pid = wpid;
+      if (wpid > 0)
+        pid_insert(wpid, idx);
+      close(p[0]);
+    }
   } else {
-    // Fork failure
-    printf("[init] Failed to fork %s\n", services[idx].name);
+    // Fork failure: the scheduler retries or reports it
+    if (p[0] >= 0) {
+      close(p[0]);
+      close(p[1]);
+    }
+  }
+  return pid;
+}
+
+
+// ----------- SCHEDULER OPERATIONS --------------------------
+
+int exec_unread;                               // Exec records known to be in exec_pipe
+
+// Records the exit of a service process or its logger, or the readiness
+// its watcher reported; other pids (orphans) are ignored
+void note_exit(int wpid, int status) {
+  int i = pid_reaped(wpid);
+  if (i < 0)
+    return;
+  if (svc_state[i].pid == wpid) {
+    svc_times[i].exit_tick = uptime();
+    log_event(EV_EXIT, i, wpid, status);
+  } else if (svc_state[i].watcher_pid == wpid && status == 0) {
+    log_event(EV_READY, i, svc_state[i].pid, 0);
+  } else if (svc_state[i].logger_pid == wpid) {
+    svc_state[i].logger_pid = -1;
+  }
+}
+
+// Reaps the next child for the scheduler, noting when the shell exits
+int wait_child(int *status) {
+  bflush(&console);
+  int wpid = wait(status);
+  if (wpid >= 0 && wpid == shell_pid)
+    shell_pid = -1;                            // Restarted by main()
+  else if (wpid >= 0)
+    note_exit(wpid, *status);
+  return wpid;
+}
+
+// A service that exited or reported readiness has written its exec record,
+// so exec ticks that are already available can be read without blocking
+void collect_exec_ticks(int idx) {
+  for (exec_unread++; exec_unread > 0; exec_unread--) {
+    struct exec_record rec;
+    if (read(exec_pipe[0], &rec, sizeof(rec)) != sizeof(rec))
+      break;
+    if (rec.idx >= 0 && rec.idx < service_count)
+      svc_times[rec.idx].exec_tick = rec.tick;
+  }
+}
+
+// Returns 1 if path names a file that exec() could load
+int binary_present(char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 && st.type == T_FILE;
+}
+
+// Kills the process of service idx at shutdown
+void stop_service(int idx) {
+  kill(svc_state[idx].pid);
+  log_event(EV_STOP, idx, svc_state[idx].pid, 0);
+}
+
+// Timer for stop_services(): as with the listener, the delay is slept out
+// by a child so that its exit wakes init's wait()
+int start_timer(int ticks) {
+  bflush(&console);
+  int pid = fork();
+  if (pid == 0) {
+    close_init_fds();
+    sleep(ticks);
+    exit(0);
   }
+  timer_pid = pid;
+  return pid;
+}
+
+struct initops xv6_ops = { start_service, wait_child, collect_exec_ticks, uptime,
+                           stop_service, start_timer, 1 };   // A logger per service
+
+// Starts the waiting services with the xv6 system calls
+void run_services(void) {
+  exec_unread = 0;
+  if (pipe(exec_pipe) < 0)
+    exec_pipe[0] = exec_pipe[1] = -1;          // Boot without exec ticks
+  schedule_services(&xv6_ops);
+  if (exec_pipe[0] >= 0) {
+    close(exec_pipe[0]);
+    close(exec_pipe[1]);
+    exec_pipe[0] = exec_pipe[1] = -1;
+  }
+}
+
+// Weighs the services for the scheduler by how long each one took to
+// finish or become ready during the last boot, as recorded in TRACE_FILE.
+// Services that were not measured count as one tick.
+void weigh_from_trace() {
+  uint mark = arena_used;                      // Scratch space, released below
+  int *duration = AT(arena_alloc(service_count * sizeof(int)));
+  for (int i = 0; i < service_count; i++)
+    duration[i] = 1;
+
+  int fd = open(TRACE_FILE, O_RDONLY);
+  struct trace_header hdr;
+  if (fd >= 0 && read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == TRACE_MAGIC) {
+    struct trace_service rec;
+    for (int n = 0; n < hdr.service_count && read(fd, &rec, sizeof(rec)) == sizeof(rec); n++) {
+      rec.name[TRACE_NAME - 1] = 0;
+      int idx = find_service_idx(&conf, rec.name);
+      if (idx >= 0 && rec.fork_tick >= 0 && rec.done_tick > rec.fork_tick)
+        duration[idx] = rec.done_tick - rec.fork_tick;
+    }
+  }
+  if (fd >= 0)
+    close(fd);
+  weigh_services(duration);
+  arena_used = mark;
+}
+
+// Writes the boot timeline to TRACE_FILE for the boottrace program
+void write_boot_trace() {
+  int fd = open(TRACE_FILE, O_CREATE | O_TRUNC | O_WRONLY);
+  if (fd < 0) {
+    bprintf(&console, "[init] Could not write %s\n", TRACE_FILE);
+    return;
+  }
+  boot_trace.magic = TRACE_MAGIC;
+  boot_trace.service_count = service_count;
+  write(fd, &boot_trace, sizeof(boot_trace));
+  for (int i = 0; i < service_count; i++) {
+    struct trace_service rec;
+    memset(&rec, 0, sizeof(rec));
+    safestrcpy(rec.name, svc_name(i), TRACE_NAME);
+    rec.fork_tick = svc_times[i].fork_tick;
+    rec.exec_tick = svc_times[i].exec_tick;
+    rec.done_tick = svc_times[i].done_tick;
+    rec.exit_tick = svc_times[i].exit_tick;
+    for (int d = 0; d < services[i].dep_idx_count && d < TRACE_DEPS; d++)
+      rec.deps[rec.dep_count++] = svc_deps(i)[d];
+    write(fd, &rec, sizeof(rec));
+  }
+  close(fd);
 }
 
 // Runs all shell commands parsed from the conf file (not tied to services)
 void run_shellcmds() {
-  for (int c = 0; c < shellcmd_count; c++) {
-    char *line = shellcmds[c].line;
-    if (line[0] == '#' || line[0] == '\0')
-      continue;                                // Skip comments/blank lines
+  for (uint c = conf.shellcmds; c; c = ((struct shellcmd *)AT(c))->next) {
+    struct shellcmd *cmd = AT(c);
+    if (cmd->argc == 0)
+      continue;                                // Nothing to run
+    if (cmd->missing) {
+      bprintf(&console, "[init] Not running %s: not found\n", (char *)AT(*(uint *)AT(cmd->argv)));
+      continue;
+    }
 
+    bflush(&console);
     int pid = fork();
     if (pid < 0) {
-      printf("init: fork failed\n");
+      bprintf(&console, "init: fork failed\n");
       continue;
     }
     if (pid == 0) {
-      // Child: tokenize and exec the command
+      // Child: exec the command, split when the config was parsed
       char *argv[MAX_CMD_ARGS];
-      char linecopy[MAX_LINE];
-      safestrcpy(linecopy, line, MAX_LINE);
-      tokenize_cmd(linecopy, argv);
+      uint *arg_off = AT(cmd->argv);
+      close_init_fds();
+      for (int i = 0; i < cmd->argc; i++)
+        argv[i] = AT(arg_off[i]);
+      argv[cmd->argc] = 0;
 
       exec(argv[0], argv);                      // Execute the shell command
       printf("init: exec %s failed\n", argv[0]);
       exit(1);
     } else {
-      // Parent: wait for this shell command to finish before next
-      wait(0);
+      // Parent: wait for this shell command to finish before next. Loggers
+      // and long-running services may exit meanwhile.
+      int wpid, status;
+      while ((wpid = wait(&status)) >= 0 && wpid != pid)
+        note_exit(wpid, status);
     }
   }
 }
 
-// Reads and parses init.conf, launches all services and shell commands in order
+// ----------- COMPILED CONFIG CACHE -------------------------
+
+// Loads the parsed, resolved and sorted configuration from CACHE_FILE
+// The cache is only used if it was built from a CONF_FILE with the same
+// inode and size as *st (xv6 keeps no modification times).
+// Returns 0 on success, -1 if the cache is missing or stale.
+int load_config_cache(struct stat *st) {
+  int fd = open(CACHE_FILE, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct cache_header hdr;
+  if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+      hdr.magic != CACHE_MAGIC || hdr.version != CACHE_VERSION ||
+      hdr.conf_ino != st->ino || hdr.conf_size != st->size ||
+      hdr.arena_used < 8) {
+    close(fd);
+    return -1;
+  }
+
+  arena_reserve(hdr.arena_used);
+  int n = read(fd, arena, hdr.arena_used);     // Whole arena in one read
+  close(fd);
+  if (n != hdr.arena_used) {
+    arena_used = 0;
+    return -1;
+  }
+  arena_used = hdr.arena_used;
+  conf = hdr.conf;
+  service_count = conf.service_count;
+  services = AT(conf.services);
+  return 0;
+}
+
+// Writes the parsed configuration to CACHE_FILE, keyed by CONF_FILE's *st
+void save_config_cache(struct stat *st) {
+  struct cache_header hdr;
+  hdr.magic = CACHE_MAGIC;
+  hdr.version = CACHE_VERSION;
+  hdr.conf_ino = st->ino;
+  hdr.conf_size = st->size;
+  hdr.arena_used = arena_used;
+  hdr.conf = conf;
+
+  int fd = open(CACHE_FILE, O_CREATE | O_TRUNC | O_WRONLY);
+  if (fd < 0) {
+    bprintf(&console, "[init] Could not write %s\n", CACHE_FILE);
+    return;
+  }
+  if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+      write(fd, arena, arena_used) != arena_used) {
+    bprintf(&console, "[init] Short write to %s\n", CACHE_FILE);
+    close(fd);
+    unlink(CACHE_FILE);                        // Never leave a torn cache behind
+    return;
+  }
+  close(fd);
+}
+
+// Parses the open config file, resolves dependencies and computes boot_order
+// Returns the number of services that cannot start because of dependency cycles.
+int parse_config(int fd) {
+  char *buf;
+
+  // Parse the config file line by line, one block read at a time
+  config_begin();
+  readlninit(&conf_reader, fd);
+  while ((buf = readln(&conf_reader)) != 0)
+    config_line(buf);
+  return config_end();
+}
+
+// Loads init.conf (from the compiled cache when it is current), launches
+// all services and then the shell commands
 void boot_services_and_commands() {
-  int fd = open("init.conf", O_RDONLY);         // Open configuration file
+  boot_trace.parse_start = uptime();
+  int fd = open(CONF_FILE, O_RDONLY);           // Open configuration file
   if (fd < 0) {
-    printf("[init] Could not open init.conf\n");
+    bprintf(&console, "[init] Could not open init.conf\n");
+    return;
+  }
+
+  struct stat st;
+  int have_stat = fstat(fd, &st) == 0;
+  if (have_stat && load_config_cache(&st) == 0) {
+    bprintf(&console, "[init] Loaded %d services from %s\n", service_count, CACHE_FILE);
+  } else {
+    // Services on or behind a cycle are skipped, the rest still boot. Such a
+    // config is not cached, so the errors are reported on every boot.
+    if (parse_config(fd) == 0 && have_stat)
+      save_config_cache(&st);                  // Skip parsing on the next boot
+  }
+  close(fd);                                   // Close config file
+  init_service_state();                        // After the cached part of the arena
+  check_binaries(binary_present);              // Before anything is forked
+  log_config(0);
+  weigh_from_trace();                          // Before this boot overwrites it
+  boot_trace.config_ready = uptime();
+
+  // Start services as soon as their dependencies have finished
+  run_services();
+  boot_trace.boot_done = uptime();
+  bprintf(&console, "[init] Services up in %d ticks\n", boot_trace.boot_done - boot_trace.parse_start);
+  write_boot_trace();
+  flush_events();
+
+  // After all services, run extra shell commands (if any)
+  run_shellcmds();
+}
+
+// ----------- CONFIG RELOAD ---------------------------------
+
+// Re-reads CONF_FILE and brings the running services in line with it,
+// reporting to reply. New services and changed ones (command, readiness or
+// dependencies) are (re)started together with everything that depends on
+// them, as are services that failed to start, removed ones are stopped,
+// and all other services keep running.
+// The services to start are left waiting for run_services().
+// Shell commands only run at boot and are not run again.
+void reload_config(struct bfile *reply) {
+  int fd = open(CONF_FILE, O_RDONLY);
+  if (fd < 0) {
+    bprintf(reply, "reload: cannot open %s\n", CONF_FILE);
+    return;
+  }
+
+  struct config old_conf = conf;
+  struct service *old = services;
+  struct svc_state *old_state = svc_state;
+  struct svc_times *old_times = svc_times;
+  int old_count = service_count;
+  uint old_used = arena_used;
+  uint from = (arena_used + 7) & ~7;           // Where the new configuration starts
+
+  bprintf(&console, "[init] Reloading %s\n", CONF_FILE);
+  if (parse_config(fd) != 0) {
+    close(fd);
+    conf = old_conf;                           // Keep running the old configuration
+    services = old;
+    service_count = old_count;
+    arena_used = old_used;
+    bprintf(reply, "reload: dependency cycle, configuration not changed\n");
     return;
   }
+  uint end = arena_used;
+  init_service_state();
+  weigh_from_trace();
+  char *dirty = AT(arena_alloc(service_count));
+  char *stop = AT(arena_alloc(old_count));
+  int added = 0, restarted = 0, removed = 0, stopping = 0;
+
+  // New and changed services, and failed ones whose binary may have been
+  // installed since, then everything that depends on them
+  for (int i = 0; i < service_count; i++) {
+    int j = find_service_idx(&old_conf, svc_name(i));
+    if (j < 0) {
+      dirty[i] = 1;
+      added++;
+    } else if (service_changed(i, old, j) || old_state[j].state == SVC_FAILED) {
+      dirty[i] = 1;                            // A failed one is checked again
+    }
+  }
+  int *order = AT(conf.boot_order);
+  for (int k = 0; k < service_count; k++) {
+    int idx = order[k];                        // Dependencies come first
+    for (int d = 0; d < services[idx].dep_idx_count && !dirty[idx]; d++)
+      dirty[idx] = dirty[svc_deps(idx)[d]];
+  }
 
-  char buf[MAX_LINE];
-  // Parse the config file line by line
-  while (readline(fd, buf, sizeof(buf)) > 0) {
-    if (buf[0] == '#' || buf[0] == '\0')
-      continue;                                // Skip comments and blanks
-    struct service svc;
-    if (parse_line(buf, &svc)) {
-      // Add parsed service to array
-      if (service_count < MAX_SERVICES)
-        services[service_count++] = svc;
+  // Unchanged services carry over; the old processes of all others stop
+  for (int j = 0; j < old_count; j++) {
+    int i = find_service_idx(&conf, AT(old[j].name));
+    if (i >= 0 && !dirty[i]) {
+      svc_state[i] = old_state[j];
+      svc_times[i] = old_times[j];
+      track_processes(i);
+      continue;
+    }
+    if (i < 0)
+      removed++;
+    else
+      restarted++;
+    if (old_state[j].pid > 0 && old_times[j].exit_tick < 0) {
+      bprintf(&console, "[init] Stopping %s (PID %d)\n", (char *)AT(old[j].name), old_state[j].pid);
+      kill(old_state[j].pid);
+      log_event(EV_STOP, j, old_state[j].pid, 0);
+      stop[j] = 1;
+      stopping++;
+    }
+  }
+  bflush(&console);
+  while (stopping > 0) {
+    int status;
+    int wpid = wait(&status);
+    if (wpid < 0)
+      break;
+    int j;
+    for (j = 0; j < old_count; j++) {
+      if (stop[j] && old_state[j].pid == wpid)
+        break;
+    }
+    if (j < old_count) {
+      log_event(EV_EXIT, j, wpid, status);
+      stop[j] = 0;
+      stopping--;
+    } else if (wpid == shell_pid) {
+      shell_pid = -1;
     } else {
-      // Otherwise treat as a shell command
-      if (shellcmd_count < MAX_CMDS)
-        safestrcpy(shellcmds[shellcmd_count++].line, buf, MAX_LINE);
+      // The event log still names the old configuration's services
+      int i = pid_reaped(wpid);
+      if (i >= 0 && svc_state[i].pid == wpid) {
+        svc_times[i].exit_tick = uptime();
+        log_event(EV_EXIT, find_service_idx(&old_conf, svc_name(i)), wpid, status);
+      } else if (i >= 0 && svc_state[i].logger_pid == wpid) {
+        svc_state[i].logger_pid = -1;
+      }
     }
   }
-  close(fd);                                   // Close config file
 
-  // Check and report error if there are any circular dependencies
-  if (has_circular_dependency()) {
-    printf("[init] Error: Circular dependency detected.\n");
-    exit(1);
+  int failed = check_binaries(binary_present);
+
+  // Keep only the new configuration in the arena and cache it
+  struct svc_state *state = svc_state;
+  struct svc_times *times = svc_times;
+  move_config(from, end);
+  struct stat st;
+  if (fstat(fd, &st) == 0)
+    save_config_cache(&st);
+  close(fd);
+  svc_state = AT(arena_move(state, service_count * sizeof(struct svc_state)));
+  svc_times = AT(arena_move(times, service_count * sizeof(struct svc_times)));
+  pid_slots = AT(arena_move(pid_slots, pid_slots_size * sizeof(struct pid_slot)));
+  log_config(1);
+
+  bprintf(reply, "reload: %d added, %d removed, %d restarted, %d unchanged, %d cannot start\n",
+          added, removed, restarted, service_count - added - restarted, failed);
+  reload_pending = 1;
+}
+
+// ----------- CONTROL CHANNEL -------------------------------
+
+// Carries out one control request, writing the reply to out
+void run_control(struct bfile *out, char *cmd, char *name) {
+  if (strcmp(cmd, "status") == 0) {
+    for (int i = 0; i < service_count; i++) {
+      char *state = "waiting";
+      if (svc_state[i].state == SVC_FAILED)
+        state = "failed";
+      else if (svc_times[i].exit_tick >= 0)
+        state = "exited";
+      else if (svc_state[i].pid > 0)
+        state = "running";
+      bprintf(out, "%s %s pid %d\n", svc_name(i), state, svc_state[i].pid);
+    }
+  } else if (strcmp(cmd, "reload") == 0) {
+    reload_config(out);
+  } else if (strcmp(cmd, "shutdown") == 0) {
+    bprintf(out, "shutdown: stopping services\n");
+    shutdown_pending = 1;
+  } else {
+    bprintf(out, "usage: initctl status | reload | shutdown\n");
   }
-  int order[MAX_SERVICES];
-  topological_sort(order);                     // Determine run order
+}
+
+// ----------- SHUTDOWN --------------------------------------
 
-  // Start each service in dependency order, waiting for each to finish
+// Returns 1 while the logger of any service is still running
+int loggers_running(void) {
   for (int i = 0; i < service_count; i++) {
-    int idx = order[i];
-    start_service(idx);
-    int wpid;
-    // Wait for the specific child process (service) to finish before next
-    while ((wpid = wait(0)) != services[idx].pid && wpid != -1)
+    if (svc_state[i].logger_pid > 0)
+      return 1;
+  }
+  return 0;
+}
+
+// Stops the shell and every service, dependents first (see stop_services()),
+// then gives the loggers up to the stop timeout to write out what the
+// services sent them and flushes the event log. xv6 cannot power off, so
+// init then only reaps orphans.
+void shutdown_system(void) {
+  int start = uptime();
+  bprintf(&console, "[init] Shutting down\n");
+  if (shell_pid > 0)
+    kill(shell_pid);                           // Nothing depends on the shell
+  int abandoned = stop_services(&xv6_ops);
+  if (timer_pid > 0)
+    kill(timer_pid);                           // Left over from the last deadline
+
+  // A logger exits once the last process holding its pipe has
+  if (loggers_running()) {
+    int status, wpid = -1;
+    int timer = start_timer(conf.stop_timeout > 0 ? conf.stop_timeout : STOP_TIMEOUT);
+    while (loggers_running() && (wpid = wait_child(&status)) >= 0 && wpid != timer)
       ;
+    if (timer > 0 && wpid != timer)
+      kill(timer);
   }
 
-  // After all services, run extra shell commands (if any)
-  run_shellcmds();
+  int ticks = uptime() - start;
+  log_event(EV_HALT, EVENT_NOSVC, abandoned, ticks);
+  flush_events();
+  if (event_fd >= 0)
+    close(event_fd);
+  bprintf(&console, "[init] Shutdown took %d ticks", ticks);
+  if (abandoned > 0)
+    bprintf(&console, ", %d services did not stop", abandoned);
+  bprintf(&console, "\n");
+  bflush(&console);
+  for (;;) {
+    if (wait(0) < 0)
+      sleep(100);                              // Nothing left to reap
+  }
 }
 
 // Static argv for launching interactive shell
@@ -319,7 +830,8 @@ char *argvsh[] = { "sh", 0 };
 
 // Main: performs system setup, runs services, then launches a shell forever
 int main(void) {
-  printf("[init] Starting system...\n");
+  bfinit(&console, 1, BF_FULL);                // Held until the console is open
+  bprintf(&console, "[init] Starting system...\n");
 
   // Prepare the console device for input/output if not present
   if(open("console", O_RDWR) < 0){
@@ -328,24 +840,67 @@ int main(void) {
   }
   dup(0);  // Duplicate stdin to stdout
   dup(0);  // Duplicate stdin to stderr
+  if (setup_control() < 0)                     // Right after the console: needs fd CTL_FD
+    bprintf(&console, "[init] Control channel unavailable\n");
+  event_fd = open(EVENT_FILE, O_CREATE | O_WRONLY | O_APPEND);
 
   // --- Start all services and shell commands from config file ---
   boot_services_and_commands();
+  // Only now, so requests sent while services start wait in the pipe
+  if (start_control_listener() < 0)
+    bprintf(&console, "[init] Cannot start control listener\n");
+  // One line for the boot benchmark (make bench): config load, service
+  // makespan, the tick at which the first shell starts, and how many
+  // services never started, which makes the makespan meaningless
+  int unstarted = 0;
+  for (int i = 0; i < service_count; i++) {
+    if (svc_times[i].fork_tick < 0)
+      unstarted++;
+  }
+  bprintf(&console, "[init] Boot ticks: parse %d makespan %d shell %d unstarted %d\n",
+         boot_trace.config_ready - boot_trace.parse_start,
+         boot_trace.boot_done - boot_trace.config_ready, uptime(), unstarted);
 
   // --- Keep init process alive: launch an interactive shell in a loop ---
   for(;;) {
-    printf("init: starting sh\n");
-    int pid = fork();
-    if(pid < 0){
-      printf("init: fork failed\n");
-      exit(1);
+    if(shell_pid < 0){
+      bprintf(&console, "init: starting sh\n");
+      bflush(&console);
+      int pid = fork();
+      if(pid < 0){
+        bprintf(&console, "init: fork failed\n");
+        bflush(&console);
+        exit(1);
+      }
+      if(pid == 0){
+        close_init_fds();
+        exec("sh", argvsh);                    // Replace with shell
+        printf("init: exec sh failed\n");
+        exit(1);
+      }
+      shell_pid = pid;
     }
-    if(pid == 0){
-      exec("sh", argvsh);                      // Replace with shell
-      printf("init: exec sh failed\n");
-      exit(1);
+
+    flush_events();                            // Before init goes idle
+    bflush(&console);
+    int status;
+    int wpid = wait(&status);
+    if(wpid == shell_pid){
+      shell_pid = -1;                          // Start a new shell
+    } else if(wpid == ctl_listener_pid){
+      ctl_listener_pid = -1;
+      handle_control();
+      if(shutdown_pending)
+        shutdown_system();                     // Does not return
+      if(reload_pending){
+        reload_pending = 0;
+        run_services();
+      }
+      if (start_control_listener() < 0)
+        bprintf(&console, "[init] Cannot start control listener\n");
+    } else {
+      note_exit(wpid, status);
     }
-    while(wait(0) != pid)
-      ;                                        // Wait for shell process to exit
   }
 }
+
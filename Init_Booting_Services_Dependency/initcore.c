@@ -0,0 +1,1008 @@
+#include "kernel/types.h"
+#include "user/user.h"
+#include "user/initcore.h"
+
+// ----------- STATE -----------------------------------------
+
+char *arena;                                    // Start of the arena
+uint arena_used;                                // Bytes handed out
+uint arena_size;                                // Bytes obtained from sbrk()
+
+struct config conf;
+int service_count = 0;                          // Actual number of services parsed
+struct service *services;                       // conf.services
+struct svc_state *svc_state;                    // One per service, not cached
+struct svc_times *svc_times;                    // One per service, not cached
+struct pid_slot *pid_slots;                     // Pid table, see pid_insert()
+int pid_slots_size;                             // A power of two
+int pid_slots_used;
+int last_reaped_pid;                            // Last pid_reaped() answer, see there
+int last_reaped_idx;
+
+struct initops *ops;                            // Set by schedule_services() and stop_services()
+
+// ----------- ARENA ALLOCATOR -------------------------------
+
+// Grows the arena so that it holds at least total bytes
+// init cannot run without its configuration, so running out of memory is fatal.
+void arena_reserve(uint total) {
+  if (total <= arena_size)
+    return;
+  uint grow = total - arena_size;
+  if (grow < ARENA_CHUNK)
+    grow = ARENA_CHUNK;
+  char *p = sbrk(grow);
+  if (p == (char *)-1 || (arena && p != arena + arena_size)) {
+    bprintf(&console, "[init] Error: out of memory for the configuration\n");
+    exit(1);
+  }
+  if (arena == 0)
+    arena = p;
+  arena_size += grow;
+}
+
+// Allocates n zeroed bytes from the arena and returns their offset
+uint arena_alloc(uint n) {
+  if (arena_used == 0)
+    arena_used = 8;                             // Offset 0 means "none"
+  uint off = (arena_used + 7) & ~7;             // Keep every record 8-byte aligned
+  arena_reserve(off + n);
+  arena_used = off + n;
+  memset(arena + off, 0, n);
+  return off;
+}
+
+// Copies n bytes from src, which may lie in the unused part of the arena,
+// to the end of the arena and returns their offset
+uint arena_move(void *src, uint n) {
+  uint off = (arena_used + 7) & ~7;
+  arena_reserve(off + n);                       // The arena never moves
+  memmove(arena + off, src, n);
+  arena_used = off + n;
+  return off;
+}
+
+// Copies the first len bytes of s into the arena as a string, once
+uint arena_strdup(char *s, int len) {
+  uint off = arena_alloc(len + 1);
+  memmove(AT(off), s, len);
+  return off;
+}
+
+// Service name, command arguments and graph edges as pointers into the arena
+char *svc_name(int idx) { return AT(services[idx].name); }
+int *svc_deps(int idx) { return AT(services[idx].deps); }
+int *svc_dependents(int idx) { return AT(services[idx].dependents); }
+
+// ----------- UTILITY FUNCTIONS -----------------------------
+
+// Trims leading/trailing whitespace and removes newline chars from a string
+void trim(char *s) {
+  int i = 0, j = 0;
+  // Skip leading spaces/tabs
+  while (s[i] == ' ' || s[i] == '\t') i++;
+  // Copy over the buffer, omitting newlines and carriage returns
+  while (s[i]) {
+    if (s[i] != '\n' && s[i] != '\r')
+      s[j++] = s[i];
+    i++;
+  }
+  s[j] = 0;  // Null-terminate the string
+}
+
+// Splits a command line into words in place: the words end up one after
+// another at the start of cmd, each terminated by a NUL. Words are separated
+// by spaces or tabs. Single or double quotes group a word, with the quotes
+// removed, and a backslash keeps the next character as it is (except inside
+// single quotes). Returns the number of words.
+int split_words(char *cmd) {
+  char *in = cmd, *out = cmd;                   // out never passes in
+  int argc = 0;
+  for (;;) {
+    while (*in == ' ' || *in == '\t') in++;     // Skip separators
+    if (*in == 0) break;
+    char quote = 0;
+    while (*in && (quote || (*in != ' ' && *in != '\t'))) {
+      if (quote && *in == quote) {
+        quote = 0;                              // Closing quote
+        in++;
+      } else if (!quote && (*in == '\'' || *in == '"')) {
+        quote = *in++;                          // Opening quote
+      } else if (*in == '\\' && quote != '\'' && in[1]) {
+        in++;                                   // Escaped character
+        *out++ = *in++;
+      } else {
+        *out++ = *in++;
+      }
+    }
+    if (*in) in++;                              // Past the separator before it is overwritten
+    *out++ = 0;                                 // Null-terminate argument
+    argc++;
+  }
+  return argc;
+}
+
+// Returns the word after word in a command split by split_words()
+char *next_word(char *word) {
+  return word + strlen(word) + 1;
+}
+
+// Tokenizes a command line into argv array for exec()
+// Splits cmd with split_words(); words beyond MAX_CMD_ARGS - 1 are dropped.
+// Returns the number of arguments (argc)
+int tokenize_cmd(char *cmd, char *argv[MAX_CMD_ARGS]) {
+  int argc = split_words(cmd);
+  if (argc > MAX_CMD_ARGS - 1)
+    argc = MAX_CMD_ARGS - 1;
+  for (int i = 0; i < argc; i++, cmd = next_word(cmd))
+    argv[i] = cmd;
+  argv[argc] = 0;                               // Null at end for exec
+  return argc;
+}
+
+// Splits the command at arena offset command once, at parse time, and
+// stores the offsets of its words; returns the offset of that argv block
+// and sets *argc. Starting the command then needs no parsing at all.
+uint store_argv(uint command, int *argc) {
+  int n = split_words(AT(command));
+  if (n > MAX_CMD_ARGS - 1) {
+    bprintf(&console, "[init] Warning: only %d arguments allowed, ignoring the rest of %s\n",
+           MAX_CMD_ARGS - 1, (char *)AT(command));
+    n = MAX_CMD_ARGS - 1;
+  }
+  uint argv = arena_alloc(n * sizeof(uint));
+  char *word = AT(command);
+  for (int i = 0; i < n; i++, word = next_word(word))
+    ((uint *)AT(argv))[i] = word - arena;
+  *argc = n;
+  return argv;
+}
+
+// Counts the space-separated words in s
+int count_words(char *s) {
+  int n = 0;
+  while (*s) {
+    while (*s == ' ') s++;
+    if (*s == 0) break;
+    n++;
+    while (*s && *s != ' ') s++;
+  }
+  return n;
+}
+
+// Parses a config file line into a service record in the arena if possible
+// Format: "name: dep1 dep2 | command". A name prefixed with '@' marks a
+// long-running service that writes "ready" to fd READY_FD once it is up;
+// its dependents start at that point instead of waiting for it to exit.
+// Returns the record's offset for a service definition, 0 for other lines
+// (e.g., comments or commands)
+uint parse_line(char *line) {
+  trim(line);                                  // Clean up whitespace, newlines
+  if (line[0] == '#' || line[0] == '\0') return 0; // Skip comment/empty lines
+
+  // Find ':' separator for dependencies
+  char *colon = strchr(line, ':');
+  if (!colon) return 0;                        // Not a service definition if missing
+
+  // Find '|' separator for command
+  char *pipe = strchr(line, '|');
+  if (!pipe) return 0;                         // Not a service definition if missing
+
+  uint off = arena_alloc(sizeof(struct service));
+
+  // --- Parse service name (left of ':') ---
+  *colon = '\0';                               // Temporarily split string at ':'
+  int notify = 0;
+  if (line[0] == '@') {                        // Opt in to readiness notification
+    notify = 1;
+    line++;
+  }
+  uint name = arena_strdup(line, strlen(line));
+  char *deps_start = colon + 1;                // Dependencies start after ':'
+
+  // --- Parse dependencies (between ':' and '|') ---
+  *pipe = '\0';                                // Temporarily split string at '|'
+  char *deps = deps_start;
+  trim(deps);
+  int dep_count = count_words(deps);
+  uint dep_names = arena_alloc(dep_count * sizeof(uint));
+  // Tokenize dependencies by spaces
+  char *tok = deps;
+  for (int d = 0; d < dep_count; d++) {
+    while (*tok == ' ') tok++;
+    char *end = tok;
+    while (*end && *end != ' ') end++;
+    uint dep = arena_strdup(tok, end - tok);   // Add each dependency
+    ((uint *)AT(dep_names))[d] = dep;
+    tok = end;
+  }
+
+  // --- Parse command (after '|') ---
+  char *cmd = pipe + 1;
+  trim(cmd);                                   // Remove whitespace/newlines
+  uint command = arena_strdup(cmd, strlen(cmd)); // Save command
+
+  // Split the command once here, so starting the service needs no parsing
+  int argc;
+  uint argv_off = store_argv(command, &argc);
+
+  struct service *svc = AT(off);
+  svc->name = name;
+  svc->notify = notify;
+  svc->dep_names = dep_names;
+  svc->dep_count = dep_count;
+  svc->argv = argv_off;
+  svc->argc = argc;
+  return off;                                  // Successfully parsed a service
+}
+
+// FNV-1a hash of a service name
+uint name_hash(char *name) {
+  uint h = 2166136261;
+  for (int i = 0; name[i]; i++) {
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Find the index of a service by name in the services of configuration c
+// Looks the name up in the open-addressing name index, whose slots hold
+// a service index + 1 (0 = empty), with linear probing
+int find_service_idx(struct config *c, char *name) {
+  int *index = AT(c->name_index);
+  struct service *svcs = AT(c->services);
+  int mask = c->name_index_size - 1;
+  for (int n = name_hash(name) & mask; index[n] != 0; n = (n + 1) & mask) {
+    if (strcmp(name, AT(svcs[index[n] - 1].name)) == 0)
+      return index[n] - 1;
+  }
+  return -1;                                   // Not found
+}
+
+// Copies the parsed service records (a list starting at first) into one
+// array and indexes them by name. Duplicate names are reported and dropped.
+void index_services(uint first, int count) {
+  conf.name_index_size = 16;
+  while (conf.name_index_size < 2 * count)
+    conf.name_index_size *= 2;                 // At most half full
+  conf.name_index = arena_alloc(conf.name_index_size * sizeof(int));
+  conf.services = arena_alloc(count * sizeof(struct service));
+  services = AT(conf.services);
+  service_count = 0;
+
+  int *index = AT(conf.name_index);
+  int mask = conf.name_index_size - 1;
+  for (uint off = first; off; off = ((struct service *)AT(off))->next) {
+    struct service *svc = AT(off);
+    char *name = AT(svc->name);
+    if (find_service_idx(&conf, name) >= 0) {
+      bprintf(&console, "[init] Duplicate service %s ignored\n", name);
+      continue;
+    }
+    int n = name_hash(name) & mask;
+    while (index[n] != 0)
+      n = (n + 1) & mask;
+    services[service_count] = *svc;
+    index[n] = ++service_count;
+  }
+  conf.service_count = service_count;
+}
+
+// Resolves every dependency name to a service index, once
+// Fills each service's deps (in-edges) and dependents (out-edges) arrays
+// so the graph algorithms below only work on integers.
+// Unknown dependency names are reported and dropped.
+void resolve_dependencies() {
+  uint count_off = arena_alloc(service_count * sizeof(int));
+
+  for (int i = 0; i < service_count; i++) {
+    struct service *svc = &services[i];
+    uint *names = AT(svc->dep_names);
+    svc->deps = arena_alloc(svc->dep_count * sizeof(int));
+    svc->dep_idx_count = 0;
+    for (int d = 0; d < svc->dep_count; d++) {
+      int dep = find_service_idx(&conf, AT(names[d]));
+      if (dep < 0) {
+        bprintf(&console, "[init] Warning: %s depends on unknown service %s\n", svc_name(i), (char *)AT(names[d]));
+        continue;
+      }
+      svc_deps(i)[svc->dep_idx_count++] = dep;
+      ((int *)AT(count_off))[dep]++;
+    }
+  }
+
+  // Each service gets an exactly sized dependents array
+  for (int i = 0; i < service_count; i++) {
+    services[i].dependents = arena_alloc(((int *)AT(count_off))[i] * sizeof(int));
+    services[i].dependent_count = 0;
+  }
+  for (int i = 0; i < service_count; i++) {
+    for (int d = 0; d < services[i].dep_idx_count; d++) {
+      int dep = svc_deps(i)[d];
+      svc_dependents(dep)[services[dep].dependent_count++] = i;
+    }
+  }
+}
+
+// ----------- START ORDER (KAHN'S ALGORITHM) ----------------
+
+// Computes the start order in one pass of Kahn's algorithm, without
+// recursion, so deep dependency chains cannot overflow init's stack.
+// Fills conf.boot_order with every service that can start, dependencies
+// first, followed by the services that cannot: those on a dependency cycle,
+// which are reported one cycle per line, and those that depend on one.
+// Returns the number of services that cannot start.
+int order_services() {
+  uint mark = arena_used;                      // Scratch space, released below
+  int *order = AT(conf.boot_order);
+  int *pending = AT(arena_alloc(service_count * sizeof(int)));
+  int head = 0, tail = 0;                      // order[] doubles as the work queue
+
+  for (int i = 0; i < service_count; i++) {
+    pending[i] = services[i].dep_idx_count;    // Missing dependencies were dropped
+    if (pending[i] == 0)
+      order[tail++] = i;
+  }
+  while (head < tail) {
+    int idx = order[head++];
+    for (int e = 0; e < services[idx].dependent_count; e++) {
+      int j = svc_dependents(idx)[e];
+      if (--pending[j] == 0)
+        order[tail++] = j;                     // Last dependency is ordered
+    }
+  }
+  int blocked = service_count - tail;
+  if (blocked == 0) {
+    arena_used = mark;
+    return 0;
+  }
+
+  // Every service left over still has a left-over dependency, so walking
+  // from one along such dependencies must end in a cycle.
+  // walk[]: 0 = not walked yet, 1 = on the current walk, 2 = walked,
+  // 3 = on a cycle
+  char *walk = AT(arena_alloc(service_count));
+  int *next = AT(arena_alloc(service_count * sizeof(int)));
+  for (int i = 0; i < service_count; i++) {
+    if (pending[i] == 0 || walk[i])
+      continue;
+    int v = i;
+    while (!walk[v]) {
+      walk[v] = 1;
+      int d = 0;
+      while (pending[svc_deps(v)[d]] == 0)
+        d++;
+      next[v] = svc_deps(v)[d];
+      v = next[v];
+    }
+    if (walk[v] == 1) {                        // Came back to this walk: a new cycle
+      bprintf(&console, "[init] Error: dependency cycle %s", svc_name(v));
+      walk[v] = 3;
+      for (int u = next[v]; u != v; u = next[u]) {
+        bprintf(&console, " -> %s", svc_name(u));
+        walk[u] = 3;
+      }
+      bprintf(&console, " -> %s\n", svc_name(v));
+    }
+    for (int u = i; walk[u] == 1; u = next[u])
+      walk[u] = 2;
+  }
+
+  for (int i = 0; i < service_count; i++) {
+    if (pending[i] == 0)
+      continue;
+    order[tail++] = i;
+    if (walk[i] != 3)
+      bprintf(&console, "[init] Not starting %s: it depends on a dependency cycle\n", svc_name(i));
+  }
+  arena_used = mark;
+  return blocked;
+}
+
+// ----------- CONFIGURATION ---------------------------------
+
+uint conf_first;                                // Parsed services, in file order
+uint *conf_last;                                // Where to link the next service
+uint *conf_last_cmd;                            // Where to link the next shell command
+int conf_count;                                 // Services parsed so far
+
+// Starts parsing a new configuration at the end of the arena
+void config_begin(void) {
+  memset(&conf, 0, sizeof(conf));
+  conf_first = 0;
+  conf_last = &conf_first;
+  conf_last_cmd = &conf.shellcmds;
+  conf_count = 0;
+}
+
+// Adds one line of the config file: a service definition, one of the
+// directives "max_parallel <n>" and "stop_timeout <ticks>", or else a shell
+// command. Comments and blank lines are skipped.
+void config_line(char *buf) {
+  if (buf[0] == '#' || buf[0] == '\0')
+    return;                                    // Skip comments and blanks
+  if (strncmp(buf, "max_parallel ", 13) == 0) {
+    conf.max_parallel = atoi(buf + 13);        // Directive, see schedule_services()
+    return;
+  }
+  if (strncmp(buf, "stop_timeout ", 13) == 0) {
+    conf.stop_timeout = atoi(buf + 13);        // Directive, see stop_services()
+    return;
+  }
+  uint off = parse_line(buf);
+  if (off) {
+    *conf_last = off;                          // Append parsed service to the list
+    conf_last = &((struct service *)AT(off))->next;
+    conf_count++;
+  } else {
+    // Otherwise treat as a shell command
+    uint cmd = arena_alloc(sizeof(struct shellcmd));
+    uint line = arena_strdup(buf, strlen(buf));
+    int argc;
+    uint argv = store_argv(line, &argc);
+    ((struct shellcmd *)AT(cmd))->argv = argv;
+    ((struct shellcmd *)AT(cmd))->argc = argc;
+    *conf_last_cmd = cmd;
+    conf_last_cmd = &((struct shellcmd *)AT(cmd))->next;
+    conf.shellcmd_count++;
+  }
+}
+
+// Resolves dependencies and computes boot_order once all lines are added
+// Returns the number of services that cannot start because of dependency
+// cycles; the others can still be booted.
+int config_end(void) {
+  index_services(conf_first, conf_count);      // One array, indexed by name
+  resolve_dependencies();                      // Names -> indices, once
+  conf.boot_order = arena_alloc(service_count * sizeof(int));
+  return order_services();                     // Determine run order
+}
+
+// Returns 1 if service idx differs from service old_idx of the previous
+// configuration old in its command, readiness or dependencies
+int service_changed(int idx, struct service *old, int old_idx) {
+  struct service *svc = &services[idx], *prev = &old[old_idx];
+  if (svc->notify != prev->notify || svc->argc != prev->argc ||
+      svc->dep_idx_count != prev->dep_idx_count)
+    return 1;
+  uint *arg = AT(svc->argv), *prev_arg = AT(prev->argv);
+  for (int i = 0; i < svc->argc; i++) {
+    if (strcmp(AT(arg[i]), AT(prev_arg[i])) != 0)
+      return 1;
+  }
+  int *prev_dep = AT(prev->deps);
+  for (int d = 0; d < svc->dep_idx_count; d++) {
+    if (strcmp(svc_name(svc_deps(idx)[d]), AT(old[prev_dep[d]].name)) != 0)
+      return 1;
+  }
+  return 0;
+}
+
+// Moves the configuration parsed at arena offsets [from, end) down to the
+// start of the arena, over the configuration it replaces
+void move_config(uint from, uint end) {
+  uint delta = from - 8;
+  for (int i = 0; i < service_count; i++) {
+    struct service *svc = &services[i];
+    uint *arg = AT(svc->argv), *dep_name = AT(svc->dep_names);
+    for (int a = 0; a < svc->argc; a++)
+      arg[a] -= delta;
+    for (int d = 0; d < svc->dep_count; d++)
+      dep_name[d] -= delta;
+    svc->name -= delta;
+    svc->argv -= delta;
+    svc->dep_names -= delta;
+    svc->deps -= delta;
+    svc->dependents -= delta;
+    svc->next = 0;
+  }
+  for (uint c = conf.shellcmds; c; ) {
+    struct shellcmd *cmd = AT(c);
+    uint *arg = AT(cmd->argv);
+    c = cmd->next;
+    for (int a = 0; a < cmd->argc; a++)
+      arg[a] -= delta;
+    cmd->argv -= delta;
+    if (cmd->next)
+      cmd->next -= delta;
+  }
+  conf.services -= delta;
+  conf.name_index -= delta;
+  conf.boot_order -= delta;
+  if (conf.shellcmds)
+    conf.shellcmds -= delta;
+
+  memmove(arena + 8, arena + from, end - from);
+  arena_used = 8 + (end - from);
+  services = AT(conf.services);
+}
+
+// ----------- PARALLEL BOOT SCHEDULER -----------------------
+
+// Services whose dependencies have all finished, as a binary heap with the
+// service that should start first at the top
+int *ready;
+int ready_count;
+
+// Returns 1 if service a should start before service b: the one with the
+// longer chain still ahead of it, then the one earlier in the config
+int starts_before(int a, int b) {
+  if (svc_state[a].weight != svc_state[b].weight)
+    return svc_state[a].weight > svc_state[b].weight;
+  return a < b;
+}
+
+void ready_push(int idx) {
+  int i = ready_count++;
+  while (i > 0 && starts_before(idx, ready[(i - 1) / 2])) {
+    ready[i] = ready[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  ready[i] = idx;
+}
+
+int ready_pop(void) {
+  int top = ready[0];
+  int last = ready[--ready_count];
+  int i = 0;
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= ready_count)
+      break;
+    if (c + 1 < ready_count && starts_before(ready[c + 1], ready[c]))
+      c++;
+    if (!starts_before(ready[c], last))
+      break;
+    ready[i] = ready[c];
+    i = c;
+  }
+  ready[i] = last;
+  return top;
+}
+
+// Marks a service as finished and queues every dependent whose last
+// unfinished dependency this was.
+void finish_service(int idx) {
+  svc_state[idx].state = SVC_DONE;
+  svc_times[idx].done_tick = ops->uptime();
+  for (int e = 0; e < services[idx].dependent_count; e++) {
+    int j = svc_dependents(idx)[e];
+    if (--svc_state[j].pending == 0 && svc_state[j].state == SVC_WAITING)
+      ready_push(j);
+  }
+}
+
+// Marks a service that could not be started as failed, together with every
+// waiting service that depends on it, so that none of them is started
+void fail_service(int idx) {
+  uint mark = arena_used;                      // Stack of failed services, released below
+  int *stack = AT(arena_alloc(service_count * sizeof(int)));
+  int top = 0;
+  bprintf(&console, "[init] Could not start %s: out of processes\n", svc_name(idx));
+  svc_state[idx].state = SVC_FAILED;
+  stack[top++] = idx;
+  while (top > 0) {
+    int i = stack[--top];
+    for (int e = 0; e < services[i].dependent_count; e++) {
+      int j = svc_dependents(i)[e];
+      if (svc_state[j].state == SVC_WAITING) {
+        bprintf(&console, "[init] Not starting %s: it depends on %s\n", svc_name(j), svc_name(i));
+        svc_state[j].state = SVC_FAILED;
+        stack[top++] = j;
+      }
+    }
+  }
+  arena_used = mark;
+}
+
+// Starts ready services, most critical first, while the running ones and
+// their helper processes stay within conf.max_parallel processes; at least
+// one service always runs, however low the limit
+// A fork that fails (xv6 has a fixed number of process slots) is retried
+// once the next running service has been reaped. With none running, no
+// slot will be freed for it, so the service fails instead.
+void start_ready(int *running) {
+  while (ready_count > 0 && (conf.max_parallel <= 0 || *running == 0 ||
+                             (*running + 1) * (1 + ops->helpers) <= conf.max_parallel)) {
+    int idx = ready[0];                        // Most critical, left queued until forked
+    svc_state[idx].pid = ops->spawn(idx);
+    if (svc_state[idx].pid > 0) {
+      ready_pop();
+      pid_insert(svc_state[idx].pid, idx);
+      svc_state[idx].state = SVC_RUNNING;      // Mark as started
+      svc_times[idx].fork_tick = ops->uptime();
+      (*running)++;
+    } else if (*running > 0) {
+      return;                                  // Retried after the next reap
+    } else {
+      ready_pop();
+      fail_service(idx);
+    }
+  }
+}
+
+// Allocates and resets the per-service scheduling state, timeline and pid table
+void init_service_state(void) {
+  svc_state = AT(arena_alloc(service_count * sizeof(struct svc_state)));
+  svc_times = AT(arena_alloc(service_count * sizeof(struct svc_times)));
+  for (pid_slots_size = 16; pid_slots_size < 4 * service_count; pid_slots_size *= 2)
+    ;
+  pid_slots = AT(arena_alloc(pid_slots_size * sizeof(struct pid_slot)));
+  pid_slots_used = 0;
+  last_reaped_pid = 0;
+  for (int i = 0; i < service_count; i++) {
+    svc_state[i].pid = -1;                      // Not running yet
+    svc_state[i].watcher_pid = -1;
+    svc_state[i].logger_pid = -1;
+    svc_state[i].state = SVC_WAITING;           // Not started yet
+    svc_times[i].fork_tick = svc_times[i].exec_tick = -1;
+    svc_times[i].done_tick = svc_times[i].exit_tick = -1;
+    svc_times[i].stop_tick = -1;
+  }
+}
+
+// ----------- PID TABLE -------------------------------------
+
+// Open-addressing table (linear probing) from the pid of every process
+// started for a service (the service itself, its readiness watcher and its
+// logger) to the service's index, as in the top-level init, so that a
+// reaped pid is found in O(1) however many services there are. There are
+// at most three such processes per service, so at four slots per service
+// the table never needs to grow.
+
+// Home slot of a pid in pid_slots
+int pid_home(int pid) {
+  return ((uint)pid * 2654435761U) & (pid_slots_size - 1);
+}
+
+// Records that pid was started for service idx
+void pid_insert(int pid, int idx) {
+  if (pid_slots_used + 1 >= pid_slots_size) {
+    bprintf(&console, "[init] Pid table full, not tracking pid %d\n", pid);
+    return;
+  }
+  pid_slots_used++;
+  int i = pid_home(pid);
+  while (pid_slots[i].pid != 0)
+    i = (i + 1) & (pid_slots_size - 1);
+  pid_slots[i].pid = pid;
+  pid_slots[i].idx = idx;
+}
+
+// Returns the service that the reaped process pid was started for, or -1,
+// and forgets the pid. Both the wait operation of the caller (note_exit() in
+// init.c) and the scheduler look up each pid they reap, so the last answer
+// is remembered for the second lookup.
+int pid_reaped(int pid) {
+  if (pid == last_reaped_pid)
+    return last_reaped_idx;
+  int mask = pid_slots_size - 1;
+  int i = pid_home(pid);
+  while (pid_slots[i].pid != pid) {
+    if (pid_slots[i].pid == 0) {
+      i = -1;                                  // Not tracked
+      break;
+    }
+    i = (i + 1) & mask;
+  }
+  last_reaped_pid = pid;
+  last_reaped_idx = i < 0 ? -1 : pid_slots[i].idx;
+  if (i < 0)
+    return -1;
+
+  // Shift later entries of the probe run back into the gap
+  pid_slots[i].pid = 0;
+  pid_slots_used--;
+  for (int j = (i + 1) & mask; pid_slots[j].pid != 0; j = (j + 1) & mask) {
+    int home = pid_home(pid_slots[j].pid);
+    // Entry j may move to the gap at i unless its home lies in (i, j]
+    if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+      continue;
+    pid_slots[i] = pid_slots[j];
+    pid_slots[j].pid = 0;
+    i = j;
+  }
+  return last_reaped_idx;
+}
+
+// Adds the processes of service idx that are still running to the pid
+// table, for a service carried over from the previous configuration
+void track_processes(int idx) {
+  if (svc_state[idx].pid > 0 && svc_times[idx].exit_tick < 0)
+    pid_insert(svc_state[idx].pid, idx);
+  if (svc_state[idx].watcher_pid > 0)
+    pid_insert(svc_state[idx].watcher_pid, idx);
+  if (svc_state[idx].logger_pid > 0)
+    pid_insert(svc_state[idx].logger_pid, idx);
+}
+
+// A distinct command binary seen by check_binaries()
+struct binary {
+  uint path;                                    // Offset of the path, 0 = empty slot
+  int present;                                  // Result of the present() check
+};
+
+// Returns the entry for path in the open-addressing table of size slots,
+// checking the binary with present() the first time the path is seen
+struct binary *lookup_binary(struct binary *tab, int size, uint path, int (*present)(char *)) {
+  int n;
+  for (n = name_hash(AT(path)) & (size - 1); tab[n].path != 0; n = (n + 1) & (size - 1)) {
+    if (strcmp(AT(tab[n].path), AT(path)) == 0)
+      return &tab[n];
+  }
+  tab[n].path = path;
+  tab[n].present = present(AT(path));
+  return &tab[n];
+}
+
+// Checks the binary of every waiting service and every shell command
+// before anything is forked, calling present() once per distinct path.
+// Commands naming the same binary are pointed at a single copy of its path.
+// A service whose binary is missing is marked SVC_FAILED, and so is every
+// waiting service that depends on one, so the scheduler never starts them.
+// Returns the number of services marked.
+int check_binaries(int (*present)(char *)) {
+  uint mark = arena_used;                      // Table of binaries, released below
+  int size = 16, failed = 0;
+  while (size < 2 * (service_count + conf.shellcmd_count))
+    size *= 2;
+  struct binary *tab = AT(arena_alloc(size * sizeof(struct binary)));
+
+  for (int i = 0; i < service_count; i++) {
+    if (svc_state[i].state != SVC_WAITING || services[i].argc == 0)
+      continue;
+    uint *arg = AT(services[i].argv);
+    struct binary *b = lookup_binary(tab, size, arg[0], present);
+    arg[0] = b->path;
+    if (!b->present) {
+      bprintf(&console, "[init] Not starting %s: %s not found\n", svc_name(i), (char *)AT(b->path));
+      svc_state[i].state = SVC_FAILED;
+      failed++;
+    }
+  }
+
+  int *order = AT(conf.boot_order);
+  for (int k = 0; k < service_count; k++) {
+    int idx = order[k];                        // Dependencies come first
+    for (int d = 0; d < services[idx].dep_idx_count && svc_state[idx].state == SVC_WAITING; d++) {
+      int dep = svc_deps(idx)[d];
+      if (svc_state[dep].state == SVC_FAILED) {
+        bprintf(&console, "[init] Not starting %s: it depends on %s\n", svc_name(idx), svc_name(dep));
+        svc_state[idx].state = SVC_FAILED;
+        failed++;
+      }
+    }
+  }
+
+  for (uint c = conf.shellcmds; c; c = ((struct shellcmd *)AT(c))->next) {
+    struct shellcmd *cmd = AT(c);
+    cmd->missing = 0;
+    if (cmd->argc == 0)
+      continue;
+    uint *arg = AT(cmd->argv);
+    struct binary *b = lookup_binary(tab, size, arg[0], present);
+    arg[0] = b->path;
+    cmd->missing = !b->present;
+  }
+  arena_used = mark;
+  return failed;
+}
+
+// Sets each service's weight: its duration plus the longest chain of
+// durations among the services that wait for it. duration[] holds the
+// ticks each service is expected to take; without it every service counts
+// as one tick, so the weight is the length of the longest chain.
+void weigh_services(int *duration) {
+  int *order = AT(conf.boot_order);
+  for (int k = service_count - 1; k >= 0; k--) {   // Dependents come first
+    int idx = order[k], longest = 0;
+    for (int e = 0; e < services[idx].dependent_count; e++) {
+      int w = svc_state[svc_dependents(idx)[e]].weight;
+      if (w > longest)
+        longest = w;
+    }
+    svc_state[idx].weight = longest + (duration ? duration[idx] : 1);
+  }
+}
+
+// Boots all waiting services, running independent ones at the same time
+// Each service counts its unfinished dependencies; services with a count of
+// zero are ready, and every wait() that reaps a service releases the
+// dependents it was holding back. Boot time is therefore bounded by the
+// longest dependency chain rather than the sum of all services.
+// At most conf.max_parallel processes (services and their loggers) run at
+// once, so a wide graph cannot exhaust the process table; ready services
+// with the heaviest chain ahead of them (see weigh_services()) start first,
+// which keeps that chain short.
+// A notify service is done when its watcher reports readiness; the service
+// itself keeps running after boot and is reaped by the caller later.
+void schedule_services(struct initops *o) {
+  uint mark = arena_used;                      // Ready queue, released below
+  int running = 0;
+  ops = o;
+  ready = AT(arena_alloc(service_count * sizeof(int)));
+  ready_count = 0;
+
+  // Count unfinished dependencies (missing ones were dropped when resolving).
+  // After a reload only the services that have to (re)start are waiting.
+  for (int i = 0; i < service_count; i++) {
+    svc_state[i].pending = 0;
+    for (int d = 0; d < services[i].dep_idx_count; d++) {
+      if (svc_state[svc_deps(i)[d]].state != SVC_DONE)
+        svc_state[i].pending++;
+    }
+  }
+
+  // Start with every service that has no unfinished dependencies
+  for (int i = 0; i < service_count; i++) {
+    if (svc_state[i].pending == 0 && svc_state[i].state == SVC_WAITING)
+      ready_push(i);
+  }
+  start_ready(&running);
+
+  // Reap services as they exit or become ready and release their dependents
+  while (running > 0) {
+    int status;
+    int wpid = ops->wait(&status);
+    if (wpid < 0)
+      break;                                   // No children left
+    int i = pid_reaped(wpid);
+    if (i >= 0 && svc_state[i].pid == wpid) {
+      svc_times[i].exit_tick = ops->uptime();
+      if (svc_state[i].state != SVC_DONE) {    // Else a ready service exited
+        running--;
+        bprintf(&console, "[init] %s (PID %d) finished\n", svc_name(i), wpid);
+        if (ops->reaped)
+          ops->reaped(i);
+        finish_service(i);
+      }
+    } else if (i >= 0 && svc_state[i].watcher_pid == wpid) {
+      svc_state[i].watcher_pid = -1;
+      // Else the pipe closed, or the service exited first and is done
+      if (status == 0 && svc_state[i].state != SVC_DONE) {
+        running--;
+        bprintf(&console, "[init] %s (PID %d) ready\n", svc_name(i), svc_state[i].pid);
+        if (ops->reaped)
+          ops->reaped(i);
+        finish_service(i);
+      }
+    }
+    start_ready(&running);
+  }
+  arena_used = mark;
+}
+
+// ----------- ORDERED SHUTDOWN ------------------------------
+
+// Services killed at shutdown, in the order they were killed, and so in
+// the order of their deadlines; stop_queue[stop_head] is the next one due
+int *stop_queue;
+int stop_head, stop_tail;
+
+// Marks a service as stopped and kills every dependency whose last running
+// dependent this was, or passes the release on if it is not running either
+void release_stop(int idx, int *stopping) {
+  int *stack = ready;                          // Services left to release
+  int top = 0;
+  stack[top++] = idx;
+  while (top > 0) {
+    int i = stack[--top];
+    if (svc_state[i].pid > 0 && svc_times[i].exit_tick < 0 && svc_state[i].state != SVC_STOPPED) {
+      bprintf(&console, "[init] Stopping %s (PID %d)\n", svc_name(i), svc_state[i].pid);
+      svc_state[i].state = SVC_STOPPING;
+      svc_times[i].stop_tick = ops->uptime();
+      stop_queue[stop_tail++] = i;             // Deadlines come in kill order
+      ops->stop(i);
+      (*stopping)++;
+      continue;                                // Released once it is reaped
+    }
+    svc_state[i].state = SVC_STOPPED;
+    for (int d = 0; d < services[i].dep_idx_count; d++) {
+      int dep = svc_deps(i)[d];
+      if (--svc_state[dep].pending == 0)
+        stack[top++] = dep;
+    }
+  }
+}
+
+int next_idle, next_stuck;                      // Scan positions of stuck_service()
+
+// Returns a service that is not stopped although nothing is being stopped,
+// preferring one that is not running, or -1 if every service is stopped.
+// Only dependency cycles leave services behind: their members never
+// started, but count each other as dependents that have not stopped.
+// Stopped services stay stopped, so each scan resumes where the last ended.
+int stuck_service(void) {
+  for (; next_idle < service_count; next_idle++) {
+    int i = next_idle;
+    if (svc_state[i].state != SVC_STOPPED && (svc_state[i].pid <= 0 || svc_times[i].exit_tick >= 0))
+      return i;
+  }
+  for (; next_stuck < service_count; next_stuck++) {
+    if (svc_state[next_stuck].state != SVC_STOPPED)
+      return next_stuck;
+  }
+  return -1;
+}
+
+// Stops every running service, dependents before the services they depend
+// on, and returns the number that had to be given up on
+// This is the boot scheduler run backwards: each service counts its
+// dependents that are still running, and is killed as soon as that count
+// reaches zero, together with every other service in the same position.
+// Shutdown time is therefore bounded by the longest dependency chain.
+// A service that has not exited conf.stop_timeout ticks (STOP_TIMEOUT if
+// unset) after it was killed is killed again and no longer waited for, so
+// one stuck process cannot hold up the services below it forever.
+int stop_services(struct initops *o) {
+  uint mark = arena_used;                      // Release stack and stop queue, released below
+  int timeout = conf.stop_timeout > 0 ? conf.stop_timeout : STOP_TIMEOUT;
+  int stopping = 0, abandoned = 0, timer_pid = -1;
+  ops = o;
+  ready = AT(arena_alloc((service_count + 1) * sizeof(int)));
+  stop_queue = AT(arena_alloc((service_count + 1) * sizeof(int)));
+  stop_head = stop_tail = 0;
+  next_idle = next_stuck = 0;
+
+  for (int i = 0; i < service_count; i++)
+    svc_state[i].pending = services[i].dependent_count;
+  for (int i = 0; i < service_count; i++) {
+    if (svc_state[i].pending == 0)
+      release_stop(i, &stopping);              // Nothing depends on it
+  }
+
+  for (;;) {
+    if (stopping == 0) {
+      int i = stuck_service();
+      if (i < 0)
+        break;                                 // All stopped
+      svc_state[i].pending = 0;
+      release_stop(i, &stopping);
+      continue;
+    }
+
+    // One timer at a time, for the earliest deadline
+    while (stop_head < stop_tail && svc_state[stop_queue[stop_head]].state != SVC_STOPPING)
+      stop_head++;                             // Reaped in time
+    if (timer_pid < 0) {
+      int deadline = svc_times[stop_queue[stop_head]].stop_tick + timeout;
+      int now = ops->uptime();
+      timer_pid = ops->timer(deadline > now ? deadline - now : 1);
+    }
+
+    int status;
+    int wpid = ops->wait(&status);
+    if (wpid < 0)
+      break;                                   // No children left
+    if (wpid == timer_pid) {
+      timer_pid = -1;
+      int now = ops->uptime();
+      while (stop_head < stop_tail && now - svc_times[stop_queue[stop_head]].stop_tick >= timeout) {
+        int i = stop_queue[stop_head++];
+        if (svc_state[i].state != SVC_STOPPING)
+          continue;                            // Reaped in time
+        bprintf(&console, "[init] %s (PID %d) did not stop within %d ticks, not waiting for it\n",
+                svc_name(i), svc_state[i].pid, timeout);
+        ops->stop(i);
+        svc_state[i].state = SVC_STOPPED;
+        stopping--;
+        abandoned++;
+        release_stop(i, &stopping);
+      }
+      continue;
+    }
+    int i = pid_reaped(wpid);
+    if (i < 0 || svc_state[i].pid != wpid)
+      continue;                                // Not a service process
+    svc_times[i].exit_tick = ops->uptime();
+    if (svc_state[i].state != SVC_STOPPING)
+      continue;                                // Exited on its own meanwhile
+    bprintf(&console, "[init] %s (PID %d) stopped\n", svc_name(i), wpid);
+    svc_state[i].state = SVC_STOPPED;
+    stopping--;
+    release_stop(i, &stopping);
+  }
+  arena_used = mark;
+  return abandoned;
+}
@@ -0,0 +1,149 @@
+// Core of the dependency init: configuration parsing, the dependency
+// graph, the parallel boot scheduler and the ordered shutdown. It makes no
+// system calls of its own apart from sbrk(); processes are started, stopped
+// and reaped through struct initops, so the same code runs in init on xv6
+// and in host-side tests and benchmarks (see notxv6/inithost.c).
+
+#define MAX_CMD_ARGS 32          // Words per command incl. the terminating null, MAXARG of exec()
+#define ARENA_CHUNK 4096         // Minimum arena growth per sbrk() call
+#define STOP_TIMEOUT 100         // Ticks a service gets to exit at shutdown, see stop_services()
+
+// Scheduling states of a service
+#define SVC_WAITING 0            // Dependencies still running
+#define SVC_RUNNING 1            // Started, neither exited nor ready yet
+#define SVC_DONE 2               // Exited or ready; dependents released
+#define SVC_FAILED 3             // Never started: its binary or a dependency's is missing
+#define SVC_STOPPING 4           // Killed at shutdown, not reaped yet
+#define SVC_STOPPED 5            // Stopped at shutdown; dependencies released
+
+// All configuration data lives in one bump arena grown with sbrk(). Records
+// refer to strings and to each other by byte offset into the arena rather
+// than by pointer, so the arena can be saved to a file and read back
+// as-is. Offset 0 is reserved to mean "none".
+extern char *arena;
+extern uint arena_used;
+extern uint arena_size;
+
+#define AT(off) ((void *)(arena + (off)))       // Arena offset to pointer
+
+// Structure representing a service definition from the config file
+// Written once while parsing and only read afterwards.
+struct service {
+  uint name;                                    // Offset of the unique service name (e.g., "S1")
+  uint argv;                                    // Offset of argc string offsets: the pre-split command
+  int argc;                                     // Number of arguments in the command
+  uint dep_names;                               // Offset of dep_count name offsets
+  int dep_count;                                // Number of dependencies this service names
+  uint deps;                                    // Offset of dep_idx_count indices of existing dependencies (in-edges)
+  int dep_idx_count;                            // Number of entries in deps
+  uint dependents;                              // Offset of dependent_count indices of dependents (out-edges)
+  int dependent_count;                          // Number of entries in dependents
+  int notify;                                   // Set to 1 if the service reports readiness on READY_FD
+  uint next;                                    // Next service in file order, used while parsing
+};
+
+// Scheduling state of a service, kept in a dense array of its own so the
+// scheduler touches a few bytes per service instead of whole records
+struct svc_state {
+  int pid;                                      // Process ID of the service's running process
+  int watcher_pid;                              // PID of the process waiting for the readiness message
+  int logger_pid;                               // PID of the process writing its output to a log, or -1
+  int pending;                                  // Dependencies not finished yet (dependents not stopped at shutdown)
+  uchar state;                                  // SVC_*
+  int weight;                                   // Longest chain of durations from here to the end of boot
+};
+
+// Boot timeline of a service, see boottrace.h
+struct svc_times {
+  int fork_tick;                                // uptime() at fork, -1 if never started
+  int exec_tick;                                // uptime() just before exec, reported by the child
+  int done_tick;                                // uptime() when dependents were released
+  int exit_tick;                                // uptime() when the process was reaped
+  int stop_tick;                                // uptime() when it was killed at shutdown, -1 if not
+};
+
+// Structure for commands in the config file that are not services
+struct shellcmd {
+  uint argv;                                    // Offset of argc string offsets: the pre-split command
+  int argc;                                     // Number of arguments in the command
+  int missing;                                  // Set by check_binaries() if argv[0] does not exist
+  uint next;                                    // Next shell command in file order
+};
+
+// Roots of the parsed configuration in the arena
+struct config {
+  int service_count;                            // Number of services parsed
+  uint services;                                // Offset of service_count service records
+  uint name_index;                              // Offset of the name index (see find_service_idx)
+  int name_index_size;                          // Slots in the name index, a power of two
+  uint boot_order;                              // Offset of service_count indices in dependency order
+  uint shellcmds;                               // Offset of the first shell command
+  int shellcmd_count;                           // Number of shell commands parsed
+  int max_parallel;                             // Processes of services run at once during boot, 0 = no limit
+  int stop_timeout;                             // Ticks to wait for a service at shutdown, 0 = STOP_TIMEOUT
+};
+
+// Slot of the pid table, see pid_insert()
+struct pid_slot {
+  int pid;                                      // 0 if the slot is empty
+  int idx;                                      // Service the process was started for
+};
+
+// Process operations the scheduler runs services with
+struct initops {
+  // Forks and execs service idx and returns its pid, or -1 if the fork
+  // failed, in which case it is retried later (see start_ready()). May set
+  // svc_state[idx].watcher_pid for a notify service.
+  int (*spawn)(int idx);
+  // Waits for any child to exit and returns its pid and exit status, or
+  // -1 if there are no children
+  int (*wait)(int *status);
+  // Called once service idx has exited or reported readiness; optional
+  void (*reaped)(int idx);
+  // Current time in ticks
+  int (*uptime)(void);
+  // Kills the running process of service idx; called a second time if it
+  // has not exited after the stop timeout
+  void (*stop)(int idx);
+  // Starts a child that exits after ticks and returns its pid, or -1
+  int (*timer)(int ticks);
+  // Processes a running service takes besides its own (init's loggers),
+  // counted against conf.max_parallel
+  int helpers;
+};
+
+extern struct bfile console;                    // Status output, set up by the caller
+extern struct config conf;
+extern int service_count;
+extern struct service *services;
+extern struct svc_state *svc_state;
+extern struct svc_times *svc_times;
+extern struct pid_slot *pid_slots;
+extern int pid_slots_size;
+
+// initcore.c
+void arena_reserve(uint);
+uint arena_alloc(uint);
+uint arena_move(void *, uint);
+uint arena_strdup(char *, int);
+char *svc_name(int);
+int *svc_deps(int);
+int *svc_dependents(int);
+void trim(char *);
+int split_words(char *);
+int tokenize_cmd(char *, char *[MAX_CMD_ARGS]);
+int find_service_idx(struct config *, char *);
+void config_begin(void);
+void config_line(char *);
+int config_end(void);
+int order_services(void);
+int service_changed(int, struct service *, int);
+void move_config(uint, uint);
+void init_service_state(void);
+void pid_insert(int, int);
+int pid_reaped(int);
+void track_processes(int);
+int check_binaries(int (*)(char *));
+void weigh_services(int *);
+void schedule_services(struct initops *);
+int stop_services(struct initops *);
@@ -0,0 +1,237 @@
+// initlog: prints the events that init recorded in init.events
+//
+//   initlog [-s service] [-t from to] [-c] [file ...]
+//
+// Without files, init.events.1 (if present) and init.events are read in
+// that order. -s and -t keep only the events of one service or those
+// between two ticks; -c prints, instead of the events, how often each
+// service was started, restarted and stopped and the exit statuses it
+// returned, most recent last.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+#include "user/eventlog.h"
+
+#define NAME_MAX 32              // Longer service names are truncated
+#define READ_EVENTS 64           // Events read at a time
+#define HISTORY 8                // Exit statuses kept per service for -c
+
+// Totals for one service name, across all configurations
+struct summary {
+  char name[NAME_MAX];
+  int starts;
+  int restarts;                  // Starts after the first in the same boot
+  int last_boot;                 // Boot in which it was last started
+  int stops;
+  int fails;
+  int exits;
+  int history[HISTORY];          // Last exit statuses, oldest first
+  struct summary *next;
+};
+
+char *only_service;              // -s
+int from_tick, to_tick = -1;     // -t; to_tick < 0 means no limit
+int counting;                    // -c
+int boots;                       // Boots seen so far
+
+char (*names)[NAME_MAX];         // Names of the current configuration
+int name_count;
+struct summary *summaries;
+
+char *event_names[] = {
+  [EV_START] = "start", [EV_READY] = "ready", [EV_EXIT] = "exit",
+  [EV_STOP] = "stop", [EV_FAIL] = "fail",
+};
+
+// Starts a new name table for count services
+void
+new_config(int count)
+{
+  free(names);
+  names = malloc(count > 0 ? count * NAME_MAX : 1);
+  memset(names, 0, count > 0 ? count * NAME_MAX : 1);
+  name_count = count;
+}
+
+// Adds the next 8 bytes of the name of service svc
+void
+add_name(struct event *ev)
+{
+  if(ev->svc >= name_count)
+    return;
+  char *name = names[ev->svc];
+  int len = strlen(name);
+  for(int i = 0; i < 8 && len < NAME_MAX - 1; i++)
+    name[len++] = ((char *)&ev->pid)[i];
+  name[len] = 0;
+}
+
+// Returns the totals for name, adding them at the end if it is new
+struct summary *
+summary_of(char *name)
+{
+  struct summary **p;
+  for(p = &summaries; *p; p = &(*p)->next)
+    if(strcmp((*p)->name, name) == 0)
+      return *p;
+  *p = malloc(sizeof(**p));
+  memset(*p, 0, sizeof(**p));
+  safestrcpy((*p)->name, name, NAME_MAX);
+  (*p)->last_boot = -1;
+  return *p;
+}
+
+void
+count(struct event *ev, char *name)
+{
+  struct summary *s = summary_of(name);
+  switch(ev->type){
+  case EV_START:
+    s->starts++;
+    if(s->last_boot == boots)
+      s->restarts++;
+    s->last_boot = boots;
+    break;
+  case EV_STOP:
+    s->stops++;
+    break;
+  case EV_FAIL:
+    s->fails++;
+    break;
+  case EV_EXIT:
+    if(s->exits >= HISTORY)
+      memmove(s->history, s->history + 1, (HISTORY - 1) * sizeof(int));
+    s->history[s->exits < HISTORY ? s->exits : HISTORY - 1] = ev->status;
+    s->exits++;
+    break;
+  }
+}
+
+int
+in_range(struct event *ev)
+{
+  return ev->tick >= from_tick && (to_tick < 0 || ev->tick <= to_tick);
+}
+
+void
+event(struct event *ev)
+{
+  if(ev->type == EV_CONFIG){
+    new_config(ev->svc);
+    if(ev->status == 0 || boots == 0)
+      boots++;                                 // A log may start mid-boot
+    if(!counting && ev->status != 2 && in_range(ev))
+      printf("%d -- %s, %d services\n", ev->tick, ev->status ? "reload" : "boot", ev->svc);
+    return;
+  }
+  if(ev->type == EV_HALT){
+    if(!counting && in_range(ev)){
+      printf("%d -- shutdown in %d ticks", ev->tick, ev->status);
+      if(ev->pid > 0)
+        printf(", %d services did not stop", ev->pid);
+      printf("\n");
+    }
+    return;
+  }
+  if(ev->type == EV_NAME){
+    add_name(ev);
+    return;
+  }
+  if(ev->type < EV_START || ev->type > EV_FAIL)
+    return;
+  char *name = ev->svc < name_count ? names[ev->svc] : "?";
+  if(only_service && strcmp(name, only_service) != 0)
+    return;
+  if(!in_range(ev))
+    return;
+  if(counting){
+    count(ev, name);
+    return;
+  }
+  printf("%d %s %s", ev->tick, name, event_names[ev->type]);
+  if(ev->pid > 0)
+    printf(" pid %d", ev->pid);
+  if(ev->type == EV_EXIT)
+    printf(" status %d", ev->status);
+  printf("\n");
+}
+
+// Decodes one event file; returns -1 if it cannot be opened
+int
+decode(char *file)
+{
+  struct event evs[READ_EVENTS];
+  int fd = open(file, O_RDONLY);
+  if(fd < 0)
+    return -1;
+  int n;
+  while((n = read(fd, evs, sizeof(evs))) > 0){
+    for(int i = 0; i < n / sizeof(struct event); i++)
+      event(&evs[i]);
+  }
+  close(fd);
+  return 0;
+}
+
+void
+print_summaries(void)
+{
+  for(struct summary *s = summaries; s; s = s->next){
+    printf("%s: %d starts, %d restarts, %d stops", s->name, s->starts, s->restarts, s->stops);
+    if(s->fails)
+      printf(", %d times not started", s->fails);
+    if(s->exits){
+      printf(", exit status");
+      int first = s->exits > HISTORY ? s->exits - HISTORY : 0;
+      if(first > 0)
+        printf(" ...");
+      for(int i = 0; i < s->exits - first; i++)
+        printf(" %d", s->history[i]);
+    }
+    printf("\n");
+  }
+}
+
+void
+usage(void)
+{
+  fprintf(2, "usage: initlog [-s service] [-t from to] [-c] [file ...]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+  for(i = 1; i < argc && argv[i][0] == '-'; i++){
+    if(strcmp(argv[i], "-s") == 0 && i + 1 < argc){
+      only_service = argv[++i];
+    } else if(strcmp(argv[i], "-t") == 0 && i + 2 < argc){
+      from_tick = atoi(argv[++i]);
+      to_tick = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-c") == 0){
+      counting = 1;
+    } else {
+      usage();
+    }
+  }
+
+  if(i == argc){
+    decode(EVENT_OLD);                         // Missing until the log first fills
+    if(decode(EVENT_FILE) < 0){
+      fprintf(2, "initlog: cannot open %s\n", EVENT_FILE);
+      exit(1);
+    }
+  }
+  for(; i < argc; i++){
+    if(decode(argv[i]) < 0){
+      fprintf(2, "initlog: cannot open %s\n", argv[i]);
+      exit(1);
+    }
+  }
+
+  if(counting)
+    print_summaries();
+  exit(0);
+}
@@ -0,0 +1,98 @@
+// mkbench: writes a synthetic init.conf for boot benchmarks to stdout
+//
+//   mkbench chain|fanout|diamond|random <services> [ticks] [seed] [parallel]
+//
+// Every service runs "sleep <ticks>" (random: 1 to <ticks>), so the boot
+// makespan of each shape is known in advance:
+//   chain    s1 depends on s0, s2 on s1, ...       services * ticks
+//   fanout   every service depends on s0           2 * ticks
+//   diamond  one service, four in parallel, one, four, ...
+//   random   each service depends on up to three earlier ones
+// The config starts with "max_parallel <parallel>" (default 48), since
+// xv6 cannot run more than NPROC processes; the limit counts each service's
+// logger too, so 24 services run at once and wide shapes take
+// correspondingly longer. 0 means no limit, for
+// the host-side scheduler benchmark.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DIAMOND_WIDTH 4
+#define RANDOM_DEPS 3
+#define PARALLEL 48              // Default max_parallel, leaves NPROC room for init and the shell
+
+static unsigned int seed = 1;
+
+// Small LCG, so the same seed gives the same graph on every host
+static unsigned int
+next_random(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: mkbench chain|fanout|diamond|random <services> [ticks] [seed] [parallel]\n");
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc < 3)
+    usage();
+  char *shape = argv[1];
+  int n = atoi(argv[2]);
+  int ticks = argc > 3 ? atoi(argv[3]) : 2;
+  if(argc > 4)
+    seed = atoi(argv[4]);
+  int parallel = argc > 5 ? atoi(argv[5]) : PARALLEL;
+  if(n < 1 || ticks < 1 || parallel < 0)
+    usage();
+
+  printf("# %s, %d services, sleep %d\n", shape, n, ticks);
+  if(parallel > 0)
+    printf("max_parallel %d\n", parallel);
+  for(int i = 0; i < n; i++){
+    int t = ticks;
+    printf("s%d:", i);
+    if(strcmp(shape, "chain") == 0){
+      if(i > 0)
+        printf(" s%d", i - 1);
+    } else if(strcmp(shape, "fanout") == 0){
+      if(i > 0)
+        printf(" s0");
+    } else if(strcmp(shape, "diamond") == 0){
+      // Joins at 0, 5, 10, ...; the four services between depend on the
+      // previous join and the next join depends on all four
+      int pos = i % (DIAMOND_WIDTH + 1);
+      int join = i - pos;
+      if(pos > 0)
+        printf(" s%d", join);
+      else
+        for(int d = i - DIAMOND_WIDTH; d < i; d++)
+          if(d >= 0)
+            printf(" s%d", d);
+    } else if(strcmp(shape, "random") == 0){
+      int picked[RANDOM_DEPS];
+      int deps = i < RANDOM_DEPS ? i : RANDOM_DEPS;
+      for(int d = 0; d < deps; d++){
+        int dep = next_random() % i;
+        for(int k = 0; k < d; k++)
+          if(picked[k] == dep)
+            dep = -1;
+        picked[d] = dep;
+        if(dep >= 0)
+          printf(" s%d", dep);
+      }
+      t = 1 + next_random() % ticks;
+    } else {
+      usage();
+    }
+    printf(" | sleep %d\n", t);
+  }
+  return 0;
+}
@@ -0,0 +1,527 @@
+// inithost: runs init's parser and boot scheduler (user/initcore.c) on the
+// host, with a simulated clock in place of fork, exec and wait
+//
+//   inithost check                    built-in tests
+//   inithost bench [-v] < init.conf   time parsing and scheduling
+//   inithost fuzz <iterations> [seed] parse random configs
+//
+// A service whose command is "sleep <ticks>" runs for that many simulated
+// ticks, any other command for one; when killed it takes as long again to
+// exit, except that "hang" never does. Configs for bench can be generated
+// with mkbench, e.g. mkbench/mkbench random 100000 | ./inithost bench
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "kernel/types.h"
+#include "user/initcore.h"
+
+#define HOST_ARENA (1UL << 30)   // Address space reserved for the arena
+#define LINE_MAX 1024
+#define TIMER_PIDS 1000000       // Pids of simulated timers start above those of services
+#define WATCHER_PIDS 2000000     // And those of readiness watchers above the timers
+
+static int verbose = 1;          // Print init's own messages
+static int failures;
+
+// ----------- SUPPORT FOR initcore.c ------------------------
+
+int
+host_printf(const char *fmt, ...)
+{
+  if(!verbose)
+    return 0;
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vprintf(fmt, ap);
+  va_end(ap);
+  return n;
+}
+
+// The arena must stay contiguous, so it is carved from one reservation
+// that the kernel only backs with memory as it is touched
+char *
+host_sbrk(int n)
+{
+  static char *base;
+  static unsigned long used;
+  if(base == 0 && (base = malloc(HOST_ARENA)) == 0)
+    return (char *)-1;
+  if(used + n > HOST_ARENA)
+    return (char *)-1;
+  char *p = base + used;
+  used += n;
+  return p;
+}
+
+// ----------- SIMULATED PROCESSES ---------------------------
+
+// Pending exits, a binary min-heap ordered by exit time
+struct exit_event {
+  int time;
+  int pid;
+};
+
+static struct exit_event *heap;
+static int heap_len;
+static int now;                  // Simulated uptime() in ticks
+
+static void
+heap_push(int time, int pid)
+{
+  int i = heap_len++;
+  while(i > 0 && heap[(i - 1) / 2].time > time){
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i].time = time;
+  heap[i].pid = pid;
+}
+
+static struct exit_event
+heap_pop(void)
+{
+  struct exit_event top = heap[0];
+  struct exit_event last = heap[--heap_len];
+  int i = 0;
+  for(;;){
+    int c = 2 * i + 1;
+    if(c >= heap_len)
+      break;
+    if(c + 1 < heap_len && heap[c + 1].time < heap[c].time)
+      c++;
+    if(heap[c].time >= last.time)
+      break;
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = last;
+  return top;
+}
+
+// Ticks service idx runs for
+static int
+duration(int idx)
+{
+  uint *argv = AT(services[idx].argv);
+  if(services[idx].argc >= 2 && strcmp(AT(argv[0]), "sleep") == 0)
+    return atoi(AT(argv[1]));
+  return 1;
+}
+
+// Processes that can run at once, as NPROC on xv6; fork fails beyond it
+static int slots = 1 << 30;
+static int live;
+
+// If set, a notify service reports readiness as it exits and its watcher
+// is reaped a tick after the service itself
+static int watchers;
+
+static int
+sim_spawn(int idx)
+{
+  if(live >= slots)
+    return -1;
+  live++;
+  heap_push(now + duration(idx), idx + 1);
+  if(watchers && services[idx].notify){
+    svc_state[idx].watcher_pid = WATCHER_PIDS + idx;
+    pid_insert(WATCHER_PIDS + idx, idx);
+    heap_push(now + duration(idx) + 1, WATCHER_PIDS + idx);
+  }
+  return idx + 1;                // pid 0 would mean "not started"
+}
+
+static int
+sim_wait(int *status)
+{
+  if(heap_len == 0)
+    return -1;
+  struct exit_event ev = heap_pop();
+  now = ev.time;
+  *status = 0;
+  if(ev.pid < TIMER_PIDS)
+    live--;
+  return ev.pid;
+}
+
+static int
+sim_uptime(void)
+{
+  return now;
+}
+
+// Every binary exists except "missing"; counts the checks made
+static int present_calls;
+
+static int
+sim_present(char *path)
+{
+  present_calls++;
+  return strcmp(path, "missing") != 0;
+}
+
+static int timers;
+static char *killed;             // Services already killed
+
+static void
+sim_stop(int idx)
+{
+  uint *argv = AT(services[idx].argv);
+  if(killed[idx] || strcmp(AT(argv[0]), "hang") == 0)
+    return;
+  killed[idx] = 1;
+  heap_push(now + duration(idx), idx + 1);
+}
+
+static int
+sim_timer(int ticks)
+{
+  heap_push(now + ticks, TIMER_PIDS + ++timers);
+  return TIMER_PIDS + timers;
+}
+
+static struct initops sim_ops = { sim_spawn, sim_wait, 0, sim_uptime, sim_stop, sim_timer };
+
+// ----------- HELPERS ---------------------------------------
+
+static double
+ms(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Parses the lines of text (separated by '\n') as a fresh configuration
+static int
+load(char *text)
+{
+  arena_used = 0;                // Reuse the arena from the last run
+  config_begin();
+  char *line = text;
+  while(*line){
+    char *nl = strchr(line, '\n');
+    if(nl)
+      *nl = 0;
+    config_line(line);
+    if(!nl)
+      break;
+    line = nl + 1;
+  }
+  return config_end();
+}
+
+// Runs the loaded configuration on the simulated clock; returns the makespan
+static int
+simulate(void)
+{
+  free(heap);
+  heap = malloc((service_count + 1) * sizeof(*heap));
+  heap_len = 0;
+  now = 0;
+  live = 0;
+  init_service_state();
+  present_calls = 0;
+  check_binaries(sim_present);
+  int *ticks = malloc((service_count + 1) * sizeof(int));
+  for(int i = 0; i < service_count; i++)
+    ticks[i] = duration(i);
+  weigh_services(ticks);         // As if measured by a previous boot
+  free(ticks);
+  schedule_services(&sim_ops);
+  return now;
+}
+
+// Stops the loaded configuration on the simulated clock as if every
+// service were still running, except those listed in not_running (ending
+// with -1); returns the number of services given up on
+static int
+shut_down(int *not_running)
+{
+  free(heap);
+  heap = malloc((2 * service_count + 2) * sizeof(*heap));
+  heap_len = 0;
+  now = 0;
+  init_service_state();
+  free(killed);
+  killed = calloc(service_count + 1, 1);
+  for(int i = 0; i < service_count; i++){
+    svc_state[i].pid = i + 1;
+    svc_state[i].state = SVC_DONE;
+  }
+  for(; *not_running >= 0; not_running++)
+    svc_state[*not_running].pid = -1;
+  for(int i = 0; i < service_count; i++)
+    if(svc_state[i].pid > 0)
+      pid_insert(svc_state[i].pid, i);
+  return stop_services(&sim_ops);
+}
+
+// Checks that no service was killed before all its dependents had stopped
+static int
+verify_stop(int timeout)
+{
+  for(int i = 0; i < service_count; i++){
+    if(svc_state[i].state != SVC_STOPPED)
+      return 0;
+    for(int d = 0; d < services[i].dep_idx_count; d++){
+      int dep = svc_deps(i)[d];
+      int gone = svc_times[i].exit_tick >= 0 ? svc_times[i].exit_tick : svc_times[i].stop_tick + timeout;
+      if(svc_times[dep].stop_tick >= 0 && svc_times[i].stop_tick >= 0 &&
+         svc_times[dep].stop_tick < gone)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+// Length of the longest dependency chain, computed independently of the
+// scheduler from boot_order
+static int
+critical_path(void)
+{
+  int *order = AT(conf.boot_order);
+  int *finish = calloc(service_count, sizeof(int));
+  int longest = 0;
+  for(int k = 0; k < service_count; k++){
+    int idx = order[k], start = 0;
+    for(int d = 0; d < services[idx].dep_idx_count; d++)
+      if(finish[svc_deps(idx)[d]] > start)
+        start = finish[svc_deps(idx)[d]];
+    finish[idx] = start + duration(idx);
+    if(finish[idx] > longest)
+      longest = finish[idx];
+  }
+  free(finish);
+  return longest;
+}
+
+// Checks that every service ran and that boot_order and the simulated run
+// respect every dependency
+static int
+verify(void)
+{
+  int *order = AT(conf.boot_order);
+  int *pos = malloc(service_count * sizeof(int));
+  int ok = 1;
+  for(int k = 0; k < service_count; k++)
+    pos[order[k]] = k;
+  for(int i = 0; i < service_count && ok; i++){
+    if(svc_state[i].state != SVC_DONE || svc_times[i].fork_tick < 0)
+      ok = 0;                    // Never started
+    for(int d = 0; d < services[i].dep_idx_count && ok; d++){
+      int dep = svc_deps(i)[d];
+      if(pos[dep] > pos[i] || svc_times[dep].done_tick > svc_times[i].fork_tick)
+        ok = 0;
+    }
+  }
+  free(pos);
+  return ok;
+}
+
+static void
+expect(int cond, char *what)
+{
+  if(!cond){
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+// ----------- MODES -----------------------------------------
+
+static int
+check(void)
+{
+  char buf[512];
+  verbose = 0;
+
+  strcpy(buf, "  a b\t\r\n");
+  trim(buf);
+  expect(strcmp(buf, "a b\t") == 0, "trim");
+
+  char *argv[MAX_CMD_ARGS];
+  strcpy(buf, "echo  one two");
+  expect(tokenize_cmd(buf, argv) == 3 && strcmp(argv[2], "two") == 0 && argv[3] == 0,
+         "tokenize_cmd");
+  strcpy(buf, "echo 'a b' \"c \\\"d\\\"\" e\\ f '' g\\'h");
+  expect(tokenize_cmd(buf, argv) == 6 && strcmp(argv[1], "a b") == 0 &&
+         strcmp(argv[2], "c \"d\"") == 0 && strcmp(argv[3], "e f") == 0 &&
+         argv[4][0] == 0 && strcmp(argv[5], "g'h") == 0, "quotes and escapes");
+
+  strcpy(buf, "# comment\nA: | sleep 3\nB: A | sleep 2\nC: A | sleep 5\n"
+              "D: B C ghost | sleep 1\n@E: | daemon\necho hi\n");
+  expect(load(buf) == 0 && service_count == 5, "parse");
+  expect(conf.shellcmd_count == 1, "shell commands");
+  expect(find_service_idx(&conf, "D") == 3 && find_service_idx(&conf, "X") < 0, "lookup");
+  expect(services[3].dep_idx_count == 2, "unknown dependency dropped");
+  expect(services[4].notify == 1, "notify prefix");
+  expect(simulate() == 9 && critical_path() == 9 && verify(), "diamond makespan");
+
+  strcpy(buf, "A: | sleep 1\nA: | sleep 2\n");
+  expect(load(buf) == 0 && service_count == 1 && duration(0) == 1, "duplicate ignored");
+
+  strcpy(buf, "A: C | sleep 1\nB: A | sleep 1\nC: B | sleep 1\nD: | sleep 4\n"
+              "E: A D | sleep 1\nF: F | sleep 1\n");
+  expect(load(buf) == 5, "cycles detected");
+  expect(simulate() == 4 && svc_state[3].state == SVC_DONE && svc_state[4].state == SVC_WAITING,
+         "services off the cycles still boot");
+
+  // With two slots, the start of the long chain must not wait behind the
+  // short services listed before it
+  strcpy(buf, "max_parallel 2\nS1: | sleep 5\nS2: | sleep 5\nL1: | sleep 1\n"
+              "L2: L1 | sleep 10\n");
+  expect(load(buf) == 0 && conf.max_parallel == 2, "max_parallel directive");
+  expect(simulate() == 11 && verify(), "critical path first");
+
+  // A missing binary fails its service and everything behind it, and each
+  // distinct binary is only checked once
+  strcpy(buf, "A: | missing\nB: A | sleep 1\nC: B | sleep 1\nD: | sleep 2\nE: | sleep 3\n"
+              "missing x\n");
+  expect(load(buf) == 0 && simulate() == 3 && present_calls == 2, "missing binary checked once");
+  expect(svc_state[2].state == SVC_FAILED && svc_state[4].state == SVC_DONE &&
+         svc_times[1].fork_tick < 0, "dependents of a missing binary skipped");
+  expect(((struct shellcmd *)AT(conf.shellcmds))->missing, "missing shell command");
+
+  // Shutdown runs the graph backwards: D, then B and C, then A, with E
+  // stopping alongside
+  int none[] = { -1 };
+  strcpy(buf, "A: | sleep 3\nB: A | sleep 2\nC: A | sleep 5\nD: B C | sleep 1\nE: | sleep 4\n");
+  expect(load(buf) == 0 && shut_down(none) == 0 && now == 9 && verify_stop(STOP_TIMEOUT),
+         "shutdown makespan");
+  expect(svc_times[0].stop_tick == 6 && svc_times[4].stop_tick == 0, "shutdown order");
+
+  // A service that ignores kill is given up on after the timeout; one that
+  // is not running is skipped
+  int c_down[] = { 2, -1 };
+  strcpy(buf, "stop_timeout 10\nA: | sleep 1\nB: A | hang\nC: B | sleep 1\n");
+  expect(load(buf) == 0 && conf.stop_timeout == 10, "stop_timeout directive");
+  expect(shut_down(c_down) == 1 && now == 11 && verify_stop(10) &&
+         svc_times[2].stop_tick < 0, "shutdown timeout");
+
+  // Services on a cycle never started, but must not block the ones below
+  strcpy(buf, "A: | sleep 1\nB: A C | sleep 1\nC: B | sleep 1\n");
+  int cycle[] = { 1, 2, -1 };
+  expect(load(buf) == 2 && shut_down(cycle) == 0 && svc_times[0].exit_tick == 1,
+         "shutdown past a cycle");
+
+  // More dependents than 16 bits can count: s0 must outlast all of them
+  int wide = 70000;
+  char *text = malloc(32 + wide * 24), *t = text;
+  t += sprintf(t, "s0: | sleep 1\n");
+  for(int i = 1; i <= wide; i++)
+    t += sprintf(t, "d%d: s0 | sleep 8\n", i);
+  expect(load(text) == 0 && shut_down(none) == 0 && svc_times[0].stop_tick == 8 &&
+         now == 9 && verify_stop(STOP_TIMEOUT), "shutdown of a wide fan-out");
+  free(text);
+
+  // Forks that fail for lack of process slots are retried, not counted as
+  // finished; with no slot ever freed the service and its dependents fail
+  strcpy(buf, "A: | sleep 2\nB: | sleep 2\nC: | sleep 2\nD: A | sleep 1\n");
+  slots = 2;
+  expect(load(buf) == 0 && simulate() == 4 && verify(), "fork retried when slots free up");
+  slots = 0;
+  strcpy(buf, "A: | sleep 2\nB: | sleep 2\nC: | sleep 2\nD: A | sleep 1\n");
+  expect(load(buf) == 0 && simulate() == 0 && svc_state[0].state == SVC_FAILED &&
+         svc_state[3].state == SVC_FAILED, "fork failure with nothing running");
+  slots = 1 << 30;
+
+  // A notify service reaped before its watcher is done once: D must still
+  // wait for L, and the boot for both
+  strcpy(buf, "@N: | sleep 2\nL: | sleep 5\nD: N L | sleep 1\n");
+  watchers = 1;
+  expect(load(buf) == 0 && simulate() == 6 && verify(), "service reaped before its watcher");
+  watchers = 0;
+
+  // The limit counts the helper processes (loggers) of running services too
+  strcpy(buf, "max_parallel 4\nA: | sleep 2\nB: | sleep 2\nC: | sleep 2\nD: | sleep 2\n");
+  sim_ops.helpers = 1;
+  expect(load(buf) == 0 && simulate() == 4 && verify(), "helpers counted against max_parallel");
+  strcpy(buf, "max_parallel 1\nA: | sleep 2\nB: A | sleep 2\n");
+  expect(load(buf) == 0 && simulate() == 4 && verify(), "one service runs below the helper cost");
+  sim_ops.helpers = 0;
+
+  printf("inithost check: %s\n", failures ? "FAILED" : "ok");
+  return failures != 0;
+}
+
+static int
+bench(void)
+{
+  // Read the whole config first so that only parsing is timed
+  size_t cap = 1 << 20, len = 0;
+  char *text = malloc(cap);
+  size_t n;
+  while((n = fread(text + len, 1, cap - len - 1, stdin)) > 0){
+    len += n;
+    if(len + 1 == cap)
+      text = realloc(text, cap *= 2);
+  }
+  text[len] = 0;
+
+  double t0 = ms();
+  int r = load(text);
+  double t1 = ms();
+  if(r != 0){
+    fprintf(stderr, "inithost: %d services on or behind a dependency cycle\n", r);
+    return 1;
+  }
+  int makespan = simulate();
+  double t2 = ms();
+  int expected = critical_path();
+  int ok = verify();
+
+  int edges = 0;
+  for(int i = 0; i < service_count; i++)
+    edges += services[i].dep_idx_count;
+  printf("services %d, edges %d\n", service_count, edges);
+  printf("parse+resolve+sort %.2f ms, schedule %.2f ms, arena %u bytes\n",
+         t1 - t0, t2 - t1, arena_used);
+  printf("makespan %d ticks (critical path %d), order %s\n",
+         makespan, expected, ok ? "ok" : "VIOLATED");
+  return !(ok && (conf.max_parallel > 0 || makespan == expected));
+}
+
+static int
+fuzz(int iterations, unsigned int seed)
+{
+  static const char alphabet[] = "abc:| @#\t\r12";
+  char buf[LINE_MAX];
+  verbose = 0;
+  srand(seed);
+  for(int it = 0; it < iterations; it++){
+    int len = rand() % (sizeof(buf) - 1);
+    for(int i = 0; i < len; i++)
+      buf[i] = rand() % 8 == 0 ? '\n' : alphabet[rand() % (sizeof(alphabet) - 1)];
+    buf[len] = 0;
+    if(load(buf) == 0){
+      simulate();
+      int none[] = { -1 };
+      if(!verify() || shut_down(none) != 0 || !verify_stop(STOP_TIMEOUT)){
+        fprintf(stderr, "inithost: order violated, seed %u iteration %d\n", seed, it);
+        return 1;
+      }
+    }
+  }
+  printf("inithost fuzz: %d configs ok\n", iterations);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc >= 2 && strcmp(argv[1], "check") == 0)
+    return check();
+  if(argc >= 2 && strcmp(argv[1], "bench") == 0){
+    verbose = argc > 2 && strcmp(argv[2], "-v") == 0;
+    return bench();
+  }
+  if(argc >= 3 && strcmp(argv[1], "fuzz") == 0)
+    return fuzz(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 1);
+  fprintf(stderr, "usage: inithost check | bench [-v] < init.conf | fuzz <iterations> [seed]\n");
+  return 1;
+}
@@ -0,0 +1,5 @@
+// Host stand-in for kernel/types.h, for building initcore.c with gcc
+typedef unsigned int   uint;
+typedef unsigned short ushort;
+typedef unsigned char  uchar;
+typedef unsigned long  uint64;
@@ -0,0 +1,15 @@
+// Host stand-in for user/user.h: the few library calls initcore.c uses,
+// taken from libc, plus an sbrk() and printf() supplied by inithost.c;
+// bprintf() prints straight away
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define printf host_printf
+#define sbrk host_sbrk
+#define bprintf(f, ...) host_printf(__VA_ARGS__)
+
+struct bfile;
+
+int host_printf(const char *, ...);
+char *host_sbrk(int);
@@ -1,8 +1,23 @@
+#include <stdarg.h>
+
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
+// The string and memory routines below work a 64-bit word at a time once
+// their pointers are aligned; misaligned loads trap to slow emulation on
+// RISC-V, so mismatched alignments fall back to bytes. A word can be read
+// past the end of a string as long as it is aligned, because an aligned
+// word never crosses into another page.
+typedef uint64 __attribute__((__may_alias__)) word;
+#define WSIZE sizeof(word)
+#define WMASK (WSIZE - 1)
+#define ONES 0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+#define HASZERO(w) (((w) - ONES) & ~(w) & HIGHS)   // Nonzero if a byte of w is 0
+#define ALIGNED(p) (((uint64)(p) & WMASK) == 0)
+
 //
 // wrapper so that it's OK if main() does not call exit().
 //
@@ -28,6 +43,17 @@ strcpy(char *s, const char *t)
 int
 strncmp(const char *p, const char *q, uint n) // added to this file
 {
+  if(((uint64)p & WMASK) == ((uint64)q & WMASK)){
+    while(n > 0 && !ALIGNED(p) && *p && *p == *q)
+      n--, p++, q++;
+    if(n >= WSIZE && ALIGNED(p)){
+      const word *wp = (const word *)p, *wq = (const word *)q;
+      while(n >= WSIZE && *wp == *wq && !HASZERO(*wp))
+        n -= WSIZE, wp++, wq++;
+      p = (const char *)wp;
+      q = (const char *)wq;
+    }
+  }
   while(n > 0 && *p && *p == *q)
     n--, p++, q++;
   if(n == 0)
@@ -50,6 +76,17 @@ safestrcpy(char *s, const char *t, int n) // added to this file
 int
 strcmp(const char *p, const char *q)
 {
+  if(((uint64)p & WMASK) == ((uint64)q & WMASK)){
+    while(!ALIGNED(p) && *p && *p == *q)
+      p++, q++;
+    if(ALIGNED(p)){
+      const word *wp = (const word *)p, *wq = (const word *)q;
+      while(*wp == *wq && !HASZERO(*wp))
+        wp++, wq++;
+      p = (const char *)wp;
+      q = (const char *)wq;
+    }
+  }
   while(*p && *p == *q)
     p++, q++;
   return (uchar)*p - (uchar)*q;
@@ -58,33 +95,63 @@ strcmp(const char *p, const char *q)
 uint
 strlen(const char *s)
 {
-  int n;
+  const char *p = s;
+  const word *w;
 
-  for(n = 0; s[n]; n++)
+  for(; !ALIGNED(p); p++)
+    if(*p == 0)
+      return p - s;
+  for(w = (const word *)p; !HASZERO(*w); w++)
     ;
-  return n;
+  for(p = (const char *)w; *p; p++)
+    ;
+  return p - s;
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
-  }
+  word *w, fill;
+
+  for(; n > 0 && !ALIGNED(cdst); n--)
+    *cdst++ = c;
+  fill = (uchar)c * ONES;
+  for(w = (word *)cdst; n >= WSIZE; n -= WSIZE)
+    *w++ = fill;
+  for(cdst = (char *)w; n > 0; n--)
+    *cdst++ = c;
   return dst;
 }
 
 char*
 strchr(const char *s, char c)
 {
-  for(; *s; s++)
+  const word *w;
+  word cs = (uchar)c * ONES;
+
+  for(; !ALIGNED(s); s++){
+    if(*s == 0)
+      return 0;
+    if(*s == c)
+      return (char*)s;
+  }
+  for(w = (const word *)s; !HASZERO(*w) && !HASZERO(*w ^ cs); w++)
+    ;
+  for(s = (const char *)w; *s; s++)
     if(*s == c)
       return (char*)s;
   return 0;
 }
 
+// Input read from fd 0 but not yet returned by gets()
+static char gets_buf[BFILE_SIZE];
+static int gets_pos, gets_end;
+
+// Reads a line from fd 0, a block at a time rather than a byte at a time.
+// The console returns at most one line per read(), so interactive input
+// is never read ahead; from a file or pipe, input after the line stays
+// buffered for the next call and is not seen by child processes.
 char*
 gets(char *buf, int max)
 {
@@ -92,9 +159,14 @@ gets(char *buf, int max)
   char c;
 
   for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
+    if(gets_pos == gets_end){
+      cc = read(0, gets_buf, sizeof(gets_buf));
+      if(cc < 1)
+        break;
+      gets_pos = 0;
+      gets_end = cc;
+    }
+    c = gets_buf[gets_pos++];
     buf[i++] = c;
     if(c == '\n' || c == '\r')
       break;
@@ -103,6 +175,173 @@ gets(char *buf, int max)
   return buf;
 }
 
+// Buffered output: characters collect in f->buf and go out in a single
+// write() once the buffer is full, at a newline in BF_LINE mode, or on
+// bflush(). Nothing is written at exit, so a program must bflush() its
+// streams before exiting, and before fork() so that output written
+// before the fork appears before the child's.
+void
+bfinit(struct bfile *f, int fd, int mode)
+{
+  f->fd = fd;
+  f->mode = mode;
+  f->len = 0;
+}
+
+void
+bflush(struct bfile *f)
+{
+  if(f->len > 0)
+    write(f->fd, f->buf, f->len);
+  f->len = 0;
+}
+
+void
+bputc(struct bfile *f, char c)
+{
+  f->buf[f->len++] = c;
+  if(f->len == BFILE_SIZE || (c == '\n' && f->mode == BF_LINE))
+    bflush(f);
+}
+
+void
+bwrite(struct bfile *f, const char *s, int n)
+{
+  while(n-- > 0)
+    bputc(f, *s++);
+}
+
+static char digits[] = "0123456789ABCDEF";
+
+static void
+bputint(struct bfile *f, long long xx, int base, int sgn)
+{
+  char buf[24];
+  int i = 0;
+  unsigned long long x = xx;
+
+  if(sgn && xx < 0)
+    x = -xx;
+  do{
+    buf[i++] = digits[x % base];
+  }while((x /= base) != 0);
+  if(sgn && xx < 0)
+    buf[i++] = '-';
+  while(--i >= 0)
+    bputc(f, buf[i]);
+}
+
+// Formatted output to f, with the conversions of printf():
+// %d %u %x (optionally l or ll), %p %s %c and %%.
+void
+bprintf(struct bfile *f, const char *fmt, ...)
+{
+  va_list ap;
+  char *s;
+  int c, i, l;
+
+  va_start(ap, fmt);
+  for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
+    if(c != '%'){
+      bputc(f, c);
+      continue;
+    }
+    for(l = 0; fmt[i+1] == 'l'; i++)
+      l++;
+    c = fmt[++i] & 0xff;
+    if(c == 0)
+      break;
+    if(c == 'd' || c == 'u' || c == 'x'){
+      long long v;
+      if(l >= 2)
+        v = c == 'd' ? va_arg(ap, long long) : (long long)va_arg(ap, unsigned long long);
+      else if(l == 1)
+        v = c == 'd' ? va_arg(ap, long) : (long long)va_arg(ap, unsigned long);
+      else
+        v = c == 'd' ? va_arg(ap, int) : (long long)va_arg(ap, unsigned int);
+      bputint(f, v, c == 'x' ? 16 : 10, c == 'd');
+    } else if(c == 'p'){
+      uint64 x = va_arg(ap, uint64);
+      bputc(f, '0');
+      bputc(f, 'x');
+      for(int n = 0; n < sizeof(uint64) * 2; n++, x <<= 4)
+        bputc(f, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    } else if(c == 's'){
+      if((s = va_arg(ap, char*)) == 0)
+        s = "(null)";
+      for(; *s; s++)
+        bputc(f, *s);
+    } else if(c == 'c'){
+      bputc(f, va_arg(ap, uint));
+    } else {
+      // Unknown conversion: print it as is
+      bputc(f, '%');
+      bputc(f, c);
+    }
+  }
+  va_end(ap);
+}
+
+void
+readlninit(struct linereader *lr, int fd)
+{
+  lr->fd = fd;
+  lr->pos = 0;
+  lr->end = 0;
+  lr->eof = 0;
+  lr->skip = 0;
+}
+
+// Returns the next line from lr->fd without its newline, or 0 at EOF.
+// The file is read a block at a time and the line points into lr->buf,
+// so it is only valid until the next call. A line longer than the
+// buffer is returned truncated and the rest of it is skipped.
+char*
+readln(struct linereader *lr)
+{
+  int i, n;
+  char *line;
+
+  for(;;){
+    for(i = lr->pos; i < lr->end; i++){
+      if(lr->buf[i] == '\n' || lr->buf[i] == '\r')
+        break;
+    }
+    if(i < lr->end || (lr->eof && lr->pos < lr->end)){
+      lr->buf[i] = '\0';
+      line = lr->buf + lr->pos;
+      lr->pos = i < lr->end ? i + 1 : i;
+      if(lr->skip){
+        lr->skip = 0;
+        continue;
+      }
+      return line;
+    }
+    if(lr->eof)
+      return 0;
+
+    // Move the partial line to the front and refill behind it.
+    if(lr->pos > 0){
+      memmove(lr->buf, lr->buf + lr->pos, lr->end - lr->pos);
+      lr->end -= lr->pos;
+      lr->pos = 0;
+    }
+    if(lr->end == LINEBUF_SIZE - 1){
+      lr->buf[lr->end] = '\0';
+      lr->end = 0;
+      if(lr->skip)
+        continue;
+      lr->skip = 1;
+      return lr->buf;
+    }
+    n = read(lr->fd, lr->buf + lr->end, LINEBUF_SIZE - 1 - lr->end);
+    if(n <= 0)
+      lr->eof = 1;
+    else
+      lr->end += n;
+  }
+}
+
 int
 stat(const char *n, struct stat *st)
 {
@@ -128,6 +367,30 @@ atoi(const char *s)
   return n;
 }
 
+// Copies n bytes upwards, a word at a time if dst and src are equally aligned
+void
+copy_forward(char *dst, const char *src, uint n)
+{
+  if(((uint64)dst & WMASK) == ((uint64)src & WMASK)){
+    for(; n > 0 && !ALIGNED(dst); n--)
+      *dst++ = *src++;
+    word *wd = (word *)dst;
+    const word *ws = (const word *)src;
+    for(; n >= 4 * WSIZE; n -= 4 * WSIZE, wd += 4, ws += 4){
+      wd[0] = ws[0];
+      wd[1] = ws[1];
+      wd[2] = ws[2];
+      wd[3] = ws[3];
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = *ws++;
+    dst = (char *)wd;
+    src = (const char *)ws;
+  }
+  while(n-- > 0)
+    *dst++ = *src++;
+}
+
 void*
 memmove(void *vdst, const void *vsrc, int n)
 {
@@ -136,12 +399,24 @@ memmove(void *vdst, const void *vsrc, int n)
 
   dst = vdst;
   src = vsrc;
-  if (src > dst) {
-    while(n-- > 0)
-      *dst++ = *src++;
+  if (n <= 0 || dst == src)
+    return vdst;
+  if (src > dst || src + n <= dst) {
+    copy_forward(dst, src, n);
   } else {
+    // Overlapping with dst above src: copy downwards
     dst += n;
     src += n;
+    if(((uint64)dst & WMASK) == ((uint64)src & WMASK)){
+      for(; n > 0 && !ALIGNED(dst); n--)
+        *--dst = *--src;
+      word *wd = (word *)dst;
+      const word *ws = (const word *)src;
+      for(; n >= WSIZE; n -= WSIZE)
+        *--wd = *--ws;
+      dst = (char *)wd;
+      src = (const char *)ws;
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -152,6 +427,17 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if(((uint64)p1 & WMASK) == ((uint64)p2 & WMASK)){
+    for(; n > 0 && !ALIGNED(p1) && *p1 == *p2; n--)
+      p1++, p2++;
+    if(ALIGNED(p1)){
+      const word *w1 = (const word *)p1, *w2 = (const word *)p2;
+      for(; n >= WSIZE && *w1 == *w2; n -= WSIZE)
+        w1++, w2++;
+      p1 = (const char *)w1;
+      p2 = (const char *)w2;
+    }
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -162,8 +448,10 @@ memcmp(const void *s1, const void *s2, uint n)
   return 0;
 }
 
+// The regions must not overlap, so no direction check is needed
 void *
 memcpy(void *dst, const void *src, uint n)
 {
-  return memmove(dst, src, n);
+  copy_forward(dst, src, n);
+  return dst;
 }
@@ -0,0 +1,322 @@
+// ulibbench: compares ulib's word-at-a-time string and memory routines
+// with the byte-at-a-time versions they replaced
+//
+//   ulibbench [megabytes]
+//
+// Each routine is run over buffers of several sizes until it has covered
+// the given number of megabytes (default 16), and the ticks taken by the
+// old and the new version are printed side by side. Both versions are
+// checked against each other first: over the benchmark sizes, and over
+// every source and destination offset within a word for short lengths,
+// which take the unaligned head and tail paths.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define MAXSIZE 4096
+#define WORD 8                   // Word size of ulib's routines
+#define SHORT (2 * WORD)         // Longest length checked at every offset
+#define AREA (2 * WORD + SHORT + 8)
+
+char src[MAXSIZE + 8] __attribute__((aligned(8)));
+char dst[MAXSIZE + 8] __attribute__((aligned(8)));
+char str[MAXSIZE + 8] __attribute__((aligned(8)));   // 'a's, null-terminated
+char str2[MAXSIZE + 8] __attribute__((aligned(8)));  // Same string
+char expect[MAXSIZE + 8];                            // dst after the old version
+char a[AREA] __attribute__((aligned(8)));            // Offset checks, new version
+char b[AREA] __attribute__((aligned(8)));
+char old_a[AREA] __attribute__((aligned(8)));        // Same for the old version
+char old_b[AREA] __attribute__((aligned(8)));
+int sizes[] = { 16, 64, 256, 1024, 4096 };
+volatile int sink;                                   // Keeps results alive
+
+// ----------- BYTE-AT-A-TIME VERSIONS -----------------------
+
+void*
+old_memmove(void *vdst, const void *vsrc, int n)
+{
+  char *d = vdst;
+  const char *s = vsrc;
+  if(s > d){
+    while(n-- > 0)
+      *d++ = *s++;
+  } else {
+    d += n;
+    s += n;
+    while(n-- > 0)
+      *--d = *--s;
+  }
+  return vdst;
+}
+
+void*
+old_memcpy(void *d, const void *s, uint n)
+{
+  return old_memmove(d, s, n);
+}
+
+void*
+old_memset(void *d, int c, uint n)
+{
+  char *cd = d;
+  for(int i = 0; i < n; i++)
+    cd[i] = c;
+  return d;
+}
+
+uint
+old_strlen(const char *s)
+{
+  int n;
+  for(n = 0; s[n]; n++)
+    ;
+  return n;
+}
+
+char*
+old_strchr(const char *s, char c)
+{
+  for(; *s; s++)
+    if(*s == c)
+      return (char*)s;
+  return 0;
+}
+
+int
+old_strcmp(const char *p, const char *q)
+{
+  while(*p && *p == *q)
+    p++, q++;
+  return (uchar)*p - (uchar)*q;
+}
+
+int
+old_strncmp(const char *p, const char *q, uint n)
+{
+  while(n > 0 && *p && *p == *q)
+    n--, p++, q++;
+  if(n == 0)
+    return 0;
+  return (uchar)*p - (uchar)*q;
+}
+
+int
+old_memcmp(const void *s1, const void *s2, uint n)
+{
+  const char *p1 = s1, *p2 = s2;
+  while(n-- > 0){
+    if(*p1 != *p2)
+      return *p1 - *p2;
+    p1++;
+    p2++;
+  }
+  return 0;
+}
+
+// ----------- BENCHMARK -------------------------------------
+
+// One call of routine op over n bytes, old or new version
+int
+run(int op, int old, int n)
+{
+  switch(op){
+  case 0:
+    old ? old_memcpy(dst, src, n) : memcpy(dst, src, n);
+    return dst[n - 1];
+  case 1:
+    old ? old_memmove(dst + 8, dst, n) : memmove(dst + 8, dst, n);   // Overlapping
+    return dst[n - 1];
+  case 2:
+    old ? old_memset(dst, n, n) : memset(dst, n, n);
+    return dst[n - 1];
+  case 3:
+    str[n] = 0;
+    return old ? old_strlen(str) : strlen(str);
+  case 4:
+    str[n] = 0;
+    return (old ? old_strchr(str, 'z') : strchr(str, 'z')) != 0;
+  case 5:
+    str[n] = str2[n] = 0;
+    return old ? old_strncmp(str, str2, n) : strncmp(str, str2, n);
+  case 6:
+    return old ? old_memcmp(src, dst, n) : memcmp(src, dst, n);
+  case 7:
+    str[n - 1] = 'z';                            // Found in the last word
+    str[n] = 0;
+    return (old ? old_strchr(str, 'z') : strchr(str, 'z')) - str;
+  }
+  return 0;
+}
+
+char *op_names[] = { "memcpy", "memmove", "memset", "strlen", "strchr", "strncmp", "memcmp",
+                     "strchr hit" };
+#define NOPS (sizeof(op_names) / sizeof(op_names[0]))
+
+// Refills the buffers that the routines read
+void
+reset(void)
+{
+  for(int i = 0; i < MAXSIZE + 8; i++){
+    src[i] = dst[i] = i * 7;
+    str[i] = str2[i] = 'a';
+  }
+  str[MAXSIZE] = str2[MAXSIZE] = 0;
+}
+
+// Checks that both versions of op give the same result and leave dst the same
+int
+check(int op, int n)
+{
+  reset();
+  int r_old = run(op, 1, n);
+  memmove(expect, dst, sizeof(expect));
+  reset();
+  int r_new = run(op, 0, n);
+  return r_old == r_new && old_memcmp(expect, dst, sizeof(expect)) == 0;
+}
+
+// ----------- OFFSET CHECKS ---------------------------------
+
+int
+sign(int x)
+{
+  return (x > 0) - (x < 0);
+}
+
+// Fills a, b and their old copies with the same letters, none of them '#'
+void
+fill(void)
+{
+  for(int i = 0; i < AREA; i++)
+    a[i] = b[i] = old_a[i] = old_b[i] = 'a' + (i * 7) % 26;
+}
+
+// Both buffers must match their old copies after a routine has run
+int
+same(void)
+{
+  return old_memcmp(a, old_a, AREA) == 0 && old_memcmp(b, old_b, AREA) == 0;
+}
+
+// Checks one source offset so, destination offset d and length n;
+// returns the name of the routine that differs, or 0
+char*
+check_offsets(int so, int d, int n)
+{
+  fill();
+  old_memmove(old_b + d, old_a + so, n);
+  memmove(b + d, a + so, n);
+  if(!same())
+    return "memmove";
+  fill();
+  old_memcpy(old_b + d, old_a + so, n);
+  memcpy(b + d, a + so, n);
+  if(!same())
+    return "memcpy";
+  fill();
+  old_memmove(old_a + WORD + d, old_a + WORD + so, n);   // Overlapping, either way
+  memmove(a + WORD + d, a + WORD + so, n);
+  if(!same())
+    return "memmove (overlapping)";
+  fill();
+  old_memset(old_b + d, so, n);
+  memset(b + d, so, n);
+  if(!same())
+    return "memset";
+
+  // Strings of n letters at a + so and b + d
+  fill();
+  a[so + n] = 0;
+  if(strlen(a + so) != n)
+    return "strlen";
+  if(strchr(a + so, '#') != 0 || strchr(a + so, 0) != old_strchr(a + so, 0))
+    return "strchr";
+  for(int k = 0; k < n; k++){
+    a[so + k] = '#';
+    if(strchr(a + so, '#') != a + so + k)
+      return "strchr";
+    a[so + k] = 'a';
+  }
+  fill();
+  a[so + n] = 0;
+  old_memmove(b + d, a + so, n + 1);
+  for(int diff = 0; diff < 3; diff++){
+    if(diff == 1 && n > 0)
+      b[d + n - 1]++;                            // Differs in the last letter
+    if(diff == 2){
+      b[d + n] = 'a';                            // b is longer
+      b[d + n + 1] = 0;
+    }
+    if(sign(strcmp(a + so, b + d)) != sign(old_strcmp(a + so, b + d)))
+      return "strcmp";
+    if(sign(strncmp(a + so, b + d, n)) != sign(old_strncmp(a + so, b + d, n)) ||
+       sign(strncmp(a + so, b + d, n + 1)) != sign(old_strncmp(a + so, b + d, n + 1)))
+      return "strncmp";
+    if(sign(memcmp(a + so, b + d, n)) != sign(old_memcmp(a + so, b + d, n)))
+      return "memcmp";
+  }
+  return 0;
+}
+
+// Ticks taken by version old of op to cover total bytes in n-byte calls
+int
+time_op(int op, int old, int n, int total)
+{
+  int calls = total / n, r = 0;
+  reset();
+  int start = uptime();
+  for(int i = 0; i < calls; i++)
+    r += run(op, old, n);
+  sink = r;
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb = argc > 1 ? atoi(argv[1]) : 16;
+  if(mb <= 0){
+    fprintf(2, "usage: ulibbench [megabytes]\n");
+    exit(1);
+  }
+
+  for(int so = 0; so < WORD; so++){
+    for(int d = 0; d < WORD; d++){
+      for(int n = 0; n <= SHORT; n++){
+        char *bad = check_offsets(so, d, n);
+        if(bad){
+          fprintf(2, "ulibbench: %s differs from the old version for %d bytes, "
+                  "offsets %d and %d\n", bad, n, so, d);
+          exit(1);
+        }
+      }
+    }
+  }
+  for(int op = 0; op < NOPS; op++){
+    for(int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+      if(!check(op, sizes[s])){
+        fprintf(2, "ulibbench: %s differs from the old version for %d bytes\n",
+                op_names[op], sizes[s]);
+        exit(1);
+      }
+    }
+  }
+
+  printf("ticks for %d MB per routine, byte-at-a-time -> word-at-a-time\n", mb);
+  printf("routine   ");
+  for(int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    printf("   %d B", sizes[s]);
+  printf("\n");
+  for(int op = 0; op < NOPS; op++){
+    printf("%s", op_names[op]);
+    for(int n = strlen(op_names[op]); n < 10; n++)
+      printf(" ");
+    for(int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+      int t_old = time_op(op, 1, sizes[s], mb * 1024 * 1024);
+      int t_new = time_op(op, 0, sizes[s], mb * 1024 * 1024);
+      printf("   %d->%d", t_old, t_new);
+    }
+    printf("\n");
+  }
+  exit(0);
+}
@@ -1,5 +1,29 @@
 struct stat;
 
+#define LINEBUF_SIZE 1024   // one disk block
+
+// Buffered line reader, see readln() in ulib.c
+struct linereader {
+  int fd;
+  int pos;                  // start of unread data in buf
+  int end;                  // end of buffered data in buf
+  int eof;
+  int skip;                 // discarding the tail of an over-long line
+  char buf[LINEBUF_SIZE];
+};
+
+#define BFILE_SIZE 512      // bytes buffered per stream
+#define BF_FULL 0           // write out when the buffer is full or flushed
+#define BF_LINE 1           // also write out at the end of every line
+
+// Buffered output stream on a file descriptor, see bprintf() in ulib.c
+struct bfile {
+  int fd;
+  int mode;                 // BF_FULL or BF_LINE
+  int len;                  // bytes waiting in buf
+  char buf[BFILE_SIZE];
+};
+
 // system calls
 int fork(void);
 int exit(int) __attribute__((noreturn));
@@ -39,6 +63,13 @@ void* memset(void*, int, uint);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void readlninit(struct linereader*, int);
+char* readln(struct linereader*);
+void bfinit(struct bfile*, int, int);
+void bflush(struct bfile*);
+void bputc(struct bfile*, char);
+void bwrite(struct bfile*, const char*, int);
+void bprintf(struct bfile*, const char*, ...) __attribute__ ((format (printf, 2, 3)));
 
 // umalloc.c
 void* malloc(uint);
@@ -6,9 +6,204 @@
 #include "kernel/file.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
+
+#define CONF_BUF BSIZE  // init.conf is read a block at a time, as LINEBUF_SIZE
 
 char *argv[] = { "sh", 0 };
 
+// Line reader for init.conf, a copy of readln() in the dependency init's
+// ulib.c (Init_Booting_Services_Dependency). This tree links the stock xv6
+// ulib and user.h, which have no line reader, so it cannot call that one;
+// keep the two in step, including how over-long lines are truncated.
+struct {
+  int fd;
+  int pos;        // start of unread data in buf
+  int end;        // end of buffered data in buf
+  int eof;
+  int skip;       // discarding the tail of an over-long line
+  char buf[CONF_BUF];
+} conf;
+
+// Background commands not yet reaped; bg_group marks those started in
+// the parallel group that is still open
+int bg_pid[NPROC];
+int bg_group[NPROC];
+int bg_count = 0;
+
+// Returns the next line of init.conf without its newline, or 0 at EOF.
+// The line points into conf.buf, so it is only valid until the next call.
+// A line longer than the buffer is returned truncated and the rest of it
+// is skipped.
+char*
+conf_line(void)
+{
+  int i, n;
+  char *line;
+
+  for(;;){
+    for(i = conf.pos; i < conf.end; i++){
+      if(conf.buf[i] == '\n' || conf.buf[i] == '\r')
+        break;
+    }
+    if(i < conf.end || (conf.eof && conf.pos < conf.end)){
+      conf.buf[i] = '\0';
+      line = conf.buf + conf.pos;
+      conf.pos = i < conf.end ? i + 1 : i;
+      if(conf.skip){
+        conf.skip = 0;
+        continue;
+      }
+      return line;
+    }
+    if(conf.eof)
+      return 0;
+
+    // Move the partial line to the front and refill behind it.
+    if(conf.pos > 0){
+      memmove(conf.buf, conf.buf + conf.pos, conf.end - conf.pos);
+      conf.end -= conf.pos;
+      conf.pos = 0;
+    }
+    if(conf.end == CONF_BUF - 1){
+      conf.buf[conf.end] = '\0';
+      conf.end = 0;
+      if(conf.skip)
+        continue;
+      conf.skip = 1;
+      return conf.buf;
+    }
+    n = read(conf.fd, conf.buf + conf.end, CONF_BUF - 1 - conf.end);
+    if(n <= 0)
+      conf.eof = 1;
+    else
+      conf.end += n;
+  }
+}
+
+// Forks a child that runs one config line; returns its pid, or -1 if the
+// fork failed, in which case the line is skipped (init must not exit)
+int
+spawn(char *line)
+{
+  int pid = fork();
+  if (pid < 0) {
+    printf("init: fork failed, skipping %s\n", line);
+    return -1;
+  }
+  if (pid == 0) {
+    char *argv_cmd[8];
+    int i = 0;
+    char *token = line;
+
+    while (*token && i < 7) {
+        while (*token == ' ')
+            token++;
+        if (*token == 0)
+            break;
+        argv_cmd[i++] = token;
+        while (*token && *token != ' ')
+            token++;
+        if (*token) {
+            *token = 0;
+            token++;
+        }
+    }
+    argv_cmd[i] = 0;
+
+    printf("init: exec %s\n", argv_cmd[0]);
+    exec(argv_cmd[0], argv_cmd);
+    printf("init: exec %s failed\n", argv_cmd[0]);
+    exit(1);
+  }
+  return pid;
+}
+
+// Counts the background commands not yet reaped, only those of the open
+// parallel group if group is set
+int
+pending(int group)
+{
+  int i, n = 0;
+
+  for (i = 0; i < bg_count; i++)
+    if (!group || bg_group[i])
+      n++;
+  return n;
+}
+
+// Forgets wpid if it is a background command; other pids (orphans) are
+// not ours to count
+void
+reaped(int wpid)
+{
+  int i;
+
+  for (i = 0; i < bg_count; i++) {
+    if (bg_pid[i] == wpid) {
+      bg_count--;
+      bg_pid[i] = bg_pid[bg_count];
+      bg_group[i] = bg_group[bg_count];
+      return;
+    }
+  }
+}
+
+// Waits for pid, noting background commands that finish meanwhile;
+// pid 0 waits for the background commands of the open parallel group if
+// group is set, or for all of them
+void
+join(int pid, int group)
+{
+  int wpid;
+
+  while ((pid != 0 || pending(group) > 0) && (wpid = wait((int *) 0)) >= 0) {
+    if (wpid == pid)
+      break;
+    reaped(wpid);
+  }
+}
+
+// Runs one line of init.conf:
+//   cmd args        run cmd and wait for it
+//   cmd args &      start cmd in the background
+//   parallel {      start every line up to the closing } in the background,
+//   }               then wait for all of them
+//   wait            wait for all background commands
+//   # comment
+void
+run_line(char *line, int *in_group)
+{
+  int len = strlen(line);
+  int pid;
+
+  while (len > 0 && line[len-1] == ' ')
+    line[--len] = 0;
+  while (*line == ' ')
+    line++, len--;
+  if (len == 0 || line[0] == '#')
+    return;
+
+  if (strcmp(line, "parallel {") == 0) {
+    *in_group = 1;
+  } else if (strcmp(line, "}") == 0) {
+    join(0, 1);
+    *in_group = 0;
+  } else if (strcmp(line, "wait") == 0) {
+    join(0, 0);
+    *in_group = 0;
+  } else if (line[len-1] == '&' || *in_group) {
+    if (line[len-1] == '&')
+      line[len-1] = 0;
+    if ((pid = spawn(line)) > 0) {
+      bg_pid[bg_count] = pid;
+      bg_group[bg_count++] = *in_group;
+    }
+  } else if ((pid = spawn(line)) > 0) {
+    join(pid, 0);
+  }
+}
+
 int
 main(void)
 {
@@ -21,69 +216,17 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
-  // Run commands from init.conf before starting shell
+  // Run commands from init.conf before starting shell; background lines
+  // not joined by a "wait" keep running alongside it
   int fd = open("init.conf", O_RDONLY);
   if (fd >= 0) {
-    char buf[512];
-    int n = read(fd, buf, sizeof(buf)-1);
-    if (n > 0) {
-      buf[n] = '\0';
-      char *line = buf;
-      char *next;
-
-      while (line && *line) {
-        next = strchr(line, '\n');
-        if (next) {
-          *next = 0;
-        }
-
-        if (strlen(line) > 0) {
-          pid = fork();
-          if (pid < 0) {
-            printf("init: fork failed\n");
-            exit(1);
-          }
-          if (pid == 0) {
-            char *argv_cmd[8];
-            int i = 0;
-            char *token = line;
-
-            while (*token && i < 7) {
-                while (*token == ' ')
-                    token++;
-                if (*token == 0)
-                    break;
-                argv_cmd[i++] = token;
-                while (*token && *token != ' ')
-                    token++;
-                if (*token) {
-                    *token = 0;
-                    token++;
-                }
-            }
-            argv_cmd[i] = 0;
-
-            printf("init: exec %s\n", argv_cmd[0]);
-            exec(argv_cmd[0], argv_cmd);
-            printf("init: exec %s failed\n", argv_cmd[0]);
-            exit(1);
-          }
-          else {
-            wait((int *) 0);
-          }
-        }
+    char *line;
+    int in_group = 0;
 
-        if (next) {
-          line = next + 1;
-        } else {
-          break;
-        }
-      }
-    }
+    conf.fd = fd;
+    while ((line = conf_line()) != 0)
+      run_line(line, &in_group);
     close(fd);
-
-    while ((wpid = wait(0)) > 0)
-      ;
     }
 
   for(;;) {
@@ -105,6 +248,8 @@ main(void)
         } else if(wpid < 0){
             printf("init: wait returned an error\n");
             exit(1);
+        } else {
+            reaped(wpid);   // a background line, or an orphan
         }
     }
   }
@@ -0,0 +1,139 @@
+// Control channel between init and initctl, see ctlchan.h
+// init calls setup_control() while fd CTL_FD is the lowest free one, then
+// start_control_listener(); once the listener has been reaped it calls
+// handle_control() to answer what it relayed, and starts a new listener.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+#include "user/ctlchan.h"
+
+int ctl_pipe[2] = { -1, -1 };
+int relay_pipe[2] = { -1, -1 };
+int ctl_listener_pid = -1;
+
+extern struct bfile console;     // init's status output, flushed before fork
+struct bfile reply_out;          // Reply to the current control request
+
+// Relayed data not handled yet: the start of a request whose end was still
+// in the control pipe when the listener read it
+char ctl_buf[2 * CTL_MAXREQ];
+int ctl_len;
+
+// Builds the reply file name for a requesting pid: /initctl.<pid>
+void ctl_reply_path(char *buf, int pid) {
+  char digits[12];
+  int n = 0;
+  do {
+    digits[n++] = '0' + pid % 10;
+    pid /= 10;
+  } while (pid > 0 && n < sizeof(digits));
+  safestrcpy(buf, "/initctl.", 16);
+  int len = strlen(buf);
+  while (n > 0)
+    buf[len++] = digits[--n];
+  buf[len] = 0;
+}
+
+// Splits req in place into at most max words; returns how many
+int ctl_split(char *req, char **argv, int max) {
+  int argc = 0;
+  while (argc < max) {
+    while (*req == ' ' || *req == '\t')
+      *req++ = 0;
+    if (*req == 0)
+      break;
+    argv[argc++] = req;
+    while (*req && *req != ' ' && *req != '\t')
+      req++;
+  }
+  return argc;
+}
+
+// Replies to one request, "<pid> <command> [<name>]", in /initctl.<pid>
+void handle_request(char *req) {
+  char *argv[3];
+  int argc = ctl_split(req, argv, 3);
+  if (argc < 2)
+    return;
+
+  char path[24], tmp[28];
+  ctl_reply_path(path, atoi(argv[0]));
+  safestrcpy(tmp, path, sizeof(tmp));
+  safestrcpy(tmp + strlen(tmp), ".t", 3);
+  int fd = open(tmp, O_CREATE | O_TRUNC | O_WRONLY);
+  if (fd < 0)
+    return;
+  bfinit(&reply_out, fd, BF_FULL);
+  run_control(&reply_out, argv[1], argc > 2 ? argv[2] : 0);
+  bflush(&reply_out);
+  close(fd);
+  link(tmp, path);                         // Reply appears complete
+  unlink(tmp);
+}
+
+// Reads the data relayed by the listener and handles every complete line
+// A listener may read several requests at once, or stop in the middle of
+// one, so only newline-terminated requests are handled and the rest waits
+// for the next listener.
+void handle_control(void) {
+  int n = read(relay_pipe[0], ctl_buf + ctl_len, sizeof(ctl_buf) - 1 - ctl_len);
+  if (n <= 0)
+    return;
+  ctl_len += n;
+  ctl_buf[ctl_len] = 0;
+  char *line = ctl_buf, *nl;
+  while ((nl = strchr(line, '\n')) != 0) {
+    *nl = 0;
+    handle_request(line);
+    line = nl + 1;
+  }
+  ctl_len = ctl_buf + ctl_len - line;
+  if (ctl_len >= CTL_MAXREQ)
+    ctl_len = 0;                           // No request is this long: drop it
+  memmove(ctl_buf, line, ctl_len);
+}
+
+// Forks the child that waits for the next control request
+// Returns -1 if the fork failed; without a channel there is nothing to do.
+int start_control_listener(void) {
+  if (ctl_pipe[0] < 0)
+    return 0;
+  bflush(&console);
+  int pid = fork();
+  if (pid == 0) {
+    char req[CTL_MAXREQ];
+    int n = read(ctl_pipe[0], req, sizeof(req) - 1);
+    if (n > 0)
+      write(relay_pipe[1], req, n);
+    exit(0);
+  }
+  ctl_listener_pid = pid;
+  return pid;
+}
+
+// Creates the control pipes; the write end must land on CTL_FD
+// Returns -1, leaving no channel, if it cannot.
+int setup_control(void) {
+  if (pipe(ctl_pipe) < 0)
+    return -1;
+  if (ctl_pipe[1] != CTL_FD || pipe(relay_pipe) < 0) {
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    ctl_pipe[0] = ctl_pipe[1] = -1;
+    return -1;
+  }
+  return 0;
+}
+
+// Closes init's private ends of the control pipes in a child, leaving only
+// CTL_FD so that descendants can send requests
+void close_control_fds(void) {
+  if (ctl_pipe[0] >= 0)
+    close(ctl_pipe[0]);
+  if (relay_pipe[0] >= 0) {
+    close(relay_pipe[0]);
+    close(relay_pipe[1]);
+  }
+}
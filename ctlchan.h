@@ -0,0 +1,28 @@
+// Control channel between init and initctl, shared by both inits
+//
+// Requests are written to the control pipe, whose write end every process
+// inherits as CTL_FD. A listener child blocks reading it and relays each
+// request to init over a private pipe before exiting, so requests wake
+// init's wait() loop like any other child exit. Replies go to a file named
+// after the requesting pid, /initctl.<pid>.
+//
+// A request is one line, "<pid> <command> [<name>]\n", shorter than
+// CTL_MAXREQ and sent with a single write(), so that requests from several
+// clients do not mix; init only acts on complete lines.
+
+#define CTL_FD 4                 // Control pipe write end, inherited by every process
+#define CTL_MAXREQ 64            // Longest control request
+
+extern int ctl_pipe[2];
+extern int relay_pipe[2];
+extern int ctl_listener_pid;     // Listener child, -1 if not running
+
+// Carries out one request, "<command> [<name>]", writing the reply to out;
+// name is 0 if the request has none. Provided by each init.
+void run_control(struct bfile *out, char *cmd, char *name);
+
+void ctl_reply_path(char *buf, int pid);
+void handle_control(void);
+int start_control_listener(void);
+int setup_control(void);
+void close_control_fds(void);
@@ -2,42 +2,130 @@
 
 #include "kernel/types.h"
 #include "kernel/stat.h" 
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
 #include "kernel/fs.h"   
+#include "kernel/file.h"
 #include "user/user.h"   
 #include "kernel/fcntl.h" 
    
+#define LOG_BUF_SIZE (2 * BSIZE)    // In-memory log buffer
+#define LOG_FLUSH_AT BSIZE          // Flush once a full block is buffered
+#define LOG_MAX (16 * BSIZE)        // Size at which init.log is rotated
 
 char *argv[] = { "sh", 0 };
 
-int log_fd = -1;
+int log_fd = -1;                    // Write end of the log writer's pipe
+int writer_pid = -1;
+
+// Log messages are formatted straight into log_buf and handed to the log
+// writer in blocks, so a message costs a copy instead of a write().
+// log_flush() is called once LOG_FLUSH_AT bytes are buffered, before every
+// fork() so a child never inherits unwritten lines, and before init gives up.
+char log_buf[LOG_BUF_SIZE];
+int log_len = 0;
+
+// Moves init.log to init.log.1 and init.log.1 to init.log.2, dropping
+// the oldest, so the log never takes more than 3 * LOG_MAX bytes of disk.
+// xv6 has no rename(), so each move is a link() and an unlink().
+void log_rotate(void) {
+    unlink("init.log.2");
+    link("init.log.1", "init.log.2");
+    unlink("init.log.1");
+    link("init.log", "init.log.1");
+    unlink("init.log");
+}
 
-void initlog(char *msg) {
-    if (log_fd < 0) {
-        log_fd = open("init.log", O_CREATE | O_WRONLY | O_APPEND);
-        if (log_fd < 0) {
-            printf("init: cannot open log file\n");
-            return;
-        }
-    }
-    char buf[512];
+// Log writer: the only process that writes init.log. It runs in its own
+// child and appends whatever arrives on in, both init's messages and the
+// shell's output, rotating the file before it would grow past LOG_MAX.
+// Exits once init and the shell have closed the pipe.
+void run_log_writer(int in) {
+    char buf[BSIZE];
+    struct stat st;
+    int fd = open("init.log", O_CREATE | O_WRONLY | O_APPEND);
+    int size = fd >= 0 && fstat(fd, &st) == 0 ? st.size : 0;
     int n;
-    
-    safestrcpy(buf, "[init] ", sizeof("[init] ")); 
-    safestrcpy(buf + strlen(buf), msg, sizeof(buf) - strlen(buf));
-    safestrcpy(buf + strlen(buf), "\n", sizeof(buf) - strlen(buf));
-
-    
-    if (n > 0) { 
-        if (write(log_fd, buf, n) != n) { 
-            printf("init: log write error during message: %s\n", msg);
+
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        if (size > 0 && size + n > LOG_MAX) {
+            if (fd >= 0)
+                close(fd);
+            log_rotate();
+            fd = open("init.log", O_CREATE | O_WRONLY | O_APPEND);
+            size = 0;
         }
+        if (fd >= 0 && write(fd, buf, n) == n)
+            size += n;                      // Dropped if the disk is full
+    }
+    exit(0);
+}
+
+// Starts the log writer and makes log_fd the write end of its pipe
+void start_log_writer(void) {
+    int p[2];
+
+    if (pipe(p) < 0) {
+        printf("init: cannot create log pipe\n");
+        return;
     }
+    writer_pid = fork();
+    if (writer_pid == 0) {
+        close(p[1]);
+        if (log_fd >= 0)
+            close(log_fd);                  // Or it would never see end of file
+        run_log_writer(p[0]);
+    }
+    close(p[0]);
+    if (writer_pid < 0) {
+        printf("init: cannot start log writer\n");
+        close(p[1]);
+        return;
+    }
+    if (log_fd >= 0)
+        close(log_fd);
+    log_fd = p[1];
+}
+
+void log_flush(void) {
+    if (log_len == 0)
+        return;
+    if (log_fd < 0) {
+        log_len = 0;                        // No log writer
+        return;
+    }
+    if (write(log_fd, log_buf, log_len) != log_len) {
+        printf("init: log write error, %d bytes lost\n", log_len);
+    }
+    log_len = 0;
+}
+
+// Appends s to log_buf, truncating it if the buffer is full
+void log_append(const char *s) {
+    while (*s && log_len < LOG_BUF_SIZE)
+        log_buf[log_len++] = *s++;
+}
+
+void initlog(char *msg) {
+    // Keep the whole line in the buffer: "[init] " + msg + "\n"
+    if (log_len + 7 + strlen(msg) + 1 > LOG_BUF_SIZE)
+        log_flush();
+
+    log_append("[init] ");
+    log_append(msg);
+    if (log_len < LOG_BUF_SIZE)
+        log_buf[log_len++] = '\n';
+    else
+        log_buf[LOG_BUF_SIZE - 1] = '\n';    // Truncated message
+
+    if (log_len >= LOG_FLUSH_AT)
+        log_flush();
 }
 
 
 void init_logging_setup() {
 
-    log_fd = open("init.log", O_CREATE | O_WRONLY | O_APPEND);
+    start_log_writer();
 
     if (log_fd < 0) {
         printf("init: failed to initialize logging system\n");
@@ -54,8 +142,6 @@ main(void)
 {
   int pid, wpid;
   
-  init_logging_setup();
-
   if(open("console", O_RDWR) < 0){
     mknod("console", CONSOLE, 0);
     open("console", O_RDWR);
@@ -63,33 +149,38 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // After the console, so the log does not take fd 0, 1 or 2
+  init_logging_setup();
+
   for(;;){
     printf("init: starting sh\n");
+    initlog("starting sh");
+    log_flush();
     pid = fork();
     if(pid < 0){
       printf("init: fork failed\n");
+      initlog("fork failed");
+      log_flush();
       exit(1);
     }
     if(pid == 0){
       
-      close(1); 
-      close(2); 
-
-      int service_log_fd = open("init.log", O_CREATE | O_WRONLY | O_APPEND);
-
-      if (service_log_fd < 0) {
-        exit(1);
-      }
+      // The shell's output goes through the log writer too, so it is
+      // capped and rotated along with init's own messages
+      if (log_fd >= 0) {
+        close(1); 
+        close(2); 
+
+        if (dup(log_fd) != 1) {
+          exit(1); 
+        }
 
-      if (dup(service_log_fd) != 1) {
-        exit(1); 
-      }
+        if (dup(log_fd) != 2) {
+          exit(1); 
+        }
 
-      if (dup(service_log_fd) != 2) {
-        exit(1); 
+        close(log_fd);
       }
-
-      close(service_log_fd);
       
       exec("sh", argv);
       printf("init: exec sh failed\n");
@@ -102,9 +193,16 @@ main(void)
       wpid = wait((int *) 0);
       if(wpid == pid){
         // the shell exited; restart it.
+        initlog("sh exited, restarting");
         break;
+      } else if(wpid == writer_pid){
+        // The shell keeps writing to the old pipe until it is restarted
+        start_log_writer();
+        initlog("log writer exited, restarted");
       } else if(wpid < 0){
         printf("init: wait returned an error\n");
+        initlog("wait returned an error");
+        log_flush();
         exit(1);
       } else {
         // it was a parentless process; do nothing.
@@ -112,9 +210,3 @@ main(void)
     }
   }
 }
-
-
-
-
-
-
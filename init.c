@@ -1,174 +1,577 @@
-
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "user/ctlchan.h"
 
 #define MAXLINE 128
 #define MAXARGS 8
-#define MAX_BG 64
+#define SLAB_SERVICES 16         // Service records allocated at a time
+#define PID_TABLE_MIN 32         // Initial pid table size (power of two)
 #define CONSOLE 1
+#define RESTART_DELAY 1          // Ticks before the first restart
+#define RESTART_DELAY_MAX 64     // Cap for the doubling restart delay
+#define RESTART_LIMIT 5          // Restarts allowed within RESTART_WINDOW
+#define RESTART_WINDOW 100       // Ticks over which restarts are counted
+
+// Background service states
+#define SVC_RUNNING 1            // Process is running
+#define SVC_BACKOFF 2            // Waiting out the restart delay
+#define SVC_STOPPED 3            // Killed on request, not restarted
+#define SVC_FAILED 4             // Crash-looping or could not be started
+#define SVC_RESTARTING 5         // Killed on request, restarted once reaped
+
+// A background ("&") service. init itself is the parent of every service
+// process and restarts it from the reaping loop when it exits.
+struct service {
+  char line[MAXLINE];            // Words of the command, each null-terminated
+  char *argv[MAXARGS];
+  int state;
+  int pid;                       // Service process, or -1
+  int timer_pid;                 // Process sleeping out the restart delay, or -1
+  int started;                   // uptime() of the last start
+  int delay;                     // Restart delay in ticks
+  int restarts;                  // Total restarts, for status output
+  int recent;                    // Restarts in the current window
+  int window_start;              // uptime() when the current window began
+  struct service *next;          // All services, or the free list
+};
+
+// Service records are carved from malloc'd slabs and recycled through a
+// free list. Records never move, so argv pointers into line stay valid.
+struct service *services;        // Every configured service
+struct service *free_services;
+
+// Open-addressing table (linear probing) from pid to the service owning
+// it, for both service processes and restart timers. Keeps reaping and
+// kill O(1) however many services there are.
+struct pid_slot {
+  int pid;                       // 0 if the slot is empty
+  struct service *svc;
+};
+struct pid_slot *pid_table;
+int pid_table_size;
+int pid_table_used;
 
+// Command binaries already looked up, so that each distinct path is
+// stat()ed once however many lines name it
+struct binary {
+  struct binary *next;
+  int present;
+  char path[];
+};
+struct binary *binaries;
+
+struct linereader conf_reader;
+
+// init's messages are buffered and written out before every fork (so a
+// child cannot inherit and repeat them) and before every wait (so they
+// reach the console while init sleeps).
+struct bfile console;
+
+// Splits line in place into at most MAXARGS-1 words. Quotes ('...' or
+// "...") keep spaces inside a word and a backslash takes the next character
+// literally. An unquoted '&' ends the word and marks the command background;
+// it is looked for up to the end of the line, past any extra words.
 void split(char *line, char **argv, int *bg) {
+  char *in = line, *out = line;                 // out never passes in
+  int argc = 0, extra = 0;
   *bg = 0;
-  while (*line) {
-    while (*line == ' ') *line++ = 0;
-    if (*line) *argv++ = line;
-    while (*line && *line != ' ') {
-      if (*line == '&') {
-        *bg = 1;
-        *line = 0;
+  for (;;) {
+    while (*in == ' ') in++;                    // Skip separators
+    if (*in == '&') {
+      *bg = 1;
+      in++;
+      continue;
+    }
+    if (*in == 0) break;
+    char *word = out;
+    char quote = 0;
+    while (*in && (quote || (*in != ' ' && *in != '&'))) {
+      if (quote && *in == quote) {
+        quote = 0;                              // Closing quote
+        in++;
+      } else if (!quote && (*in == '\'' || *in == '"')) {
+        quote = *in++;                          // Opening quote
+      } else if (*in == '\\' && quote != '\'' && in[1]) {
+        in++;                                   // Escaped character
+        *out++ = *in++;
+      } else {
+        *out++ = *in++;
       }
-      line++;
     }
+    if (*in == '&') {                           // Past the separator before it is overwritten
+      *bg = 1;
+      in++;
+    } else if (*in) {
+      in++;
+    }
+    *out++ = 0;                                 // Null-terminate argument
+    if (argc < MAXARGS - 1)
+      argv[argc++] = word;
+    else
+      extra++;                                  // Dropped, but '&' still counts
   }
-  *argv = 0;
+  argv[argc] = 0;
+  if (extra > 0)
+    bprintf(&console, "[init] Warning: more than %d arguments, extra ones ignored\n", MAXARGS - 1);
 }
 
-void run_with_restart(char **argv) {
-  int pid, wpid, status;
+// Home slot of a pid in pid_table
+int pid_home(int pid) {
+  return ((uint)pid * 2654435761U) & (pid_table_size - 1);
+}
 
-  while (1) {
-    pid = fork();
-    if (pid < 0) {
-      printf("init: fork failed for %s\n", argv[0]);
+// Returns the service that owns pid, or 0
+struct service *pid_lookup(int pid) {
+  if (pid_table_size == 0)
+    return 0;
+  for (int i = pid_home(pid); pid_table[i].pid != 0; i = (i + 1) & (pid_table_size - 1)) {
+    if (pid_table[i].pid == pid)
+      return pid_table[i].svc;
+  }
+  return 0;
+}
+
+void pid_insert(int pid, struct service *svc);
+
+// Doubles pid_table (or creates it) and re-inserts every entry
+int pid_table_grow(void) {
+  struct pid_slot *old = pid_table;
+  int old_size = pid_table_size;
+  int size = old_size ? old_size * 2 : PID_TABLE_MIN;
+  struct pid_slot *table = malloc(size * sizeof(struct pid_slot));
+  if (table == 0)
+    return -1;
+  memset(table, 0, size * sizeof(struct pid_slot));
+  pid_table = table;
+  pid_table_size = size;
+  pid_table_used = 0;
+  for (int i = 0; i < old_size; i++) {
+    if (old[i].pid != 0)
+      pid_insert(old[i].pid, old[i].svc);
+  }
+  if (old)
+    free(old);
+  return 0;
+}
+
+// Records that pid belongs to svc, keeping the table at most half full
+void pid_insert(int pid, struct service *svc) {
+  if ((pid_table_used + 1) * 2 > pid_table_size && pid_table_grow() < 0) {
+    if (pid_table_used + 1 >= pid_table_size) {
+      bprintf(&console, "init: out of memory, not tracking pid %d\n", pid);
       return;
     }
-    if (pid == 0) {
-      exec(argv[0], argv);
-      printf("init: exec %s failed\n", argv[0]);
-      exit(1);
+  }
+  int i = pid_home(pid);
+  while (pid_table[i].pid != 0)
+    i = (i + 1) & (pid_table_size - 1);
+  pid_table[i].pid = pid;
+  pid_table[i].svc = svc;
+  pid_table_used++;
+}
+
+// Forgets pid, shifting later entries of its probe run back into the gap
+void pid_remove(int pid) {
+  if (pid_table_size == 0)
+    return;
+  int mask = pid_table_size - 1;
+  int i = pid_home(pid);
+  while (pid_table[i].pid != pid) {
+    if (pid_table[i].pid == 0)
+      return;                              // Not tracked
+    i = (i + 1) & mask;
+  }
+  pid_table[i].pid = 0;
+  pid_table_used--;
+  for (int j = (i + 1) & mask; pid_table[j].pid != 0; j = (j + 1) & mask) {
+    int home = pid_home(pid_table[j].pid);
+    // Entry j may move to the gap at i unless its home lies in (i, j]
+    if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+      continue;
+    pid_table[i] = pid_table[j];
+    pid_table[j].pid = 0;
+    i = j;
+  }
+}
+
+// Takes a zeroed service record from the free list, refilling it from a new slab
+struct service *alloc_service(void) {
+  if (free_services == 0) {
+    struct service *slab = malloc(SLAB_SERVICES * sizeof(struct service));
+    if (slab == 0)
+      return 0;
+    for (int i = 0; i < SLAB_SERVICES; i++) {
+      slab[i].next = free_services;
+      free_services = &slab[i];
     }
+  }
+  struct service *svc = free_services;
+  free_services = svc->next;
+  memset(svc, 0, sizeof(*svc));
+  return svc;
+}
+
+// Returns an unlinked service record to the free list
+void free_service(struct service *svc) {
+  svc->next = free_services;
+  free_services = svc;
+}
 
-    wpid = wait(&status);
-    printf("init: background service %s (pid %d) exited with status %d, restarting...\n", argv[0], wpid, status);
+// Returns 1 if path names a file that exec() could load
+int binary_present(char *path) {
+  struct binary *b;
+  for (b = binaries; b; b = b->next) {
+    if (strcmp(b->path, path) == 0)
+      return b->present;
   }
+  struct stat st;
+  int present = stat(path, &st) == 0 && st.type == T_FILE;
+  b = malloc(sizeof(*b) + strlen(path) + 1);
+  if (b) {
+    strcpy(b->path, path);
+    b->present = present;
+    b->next = binaries;
+    binaries = b;
+  }
+  return present;
 }
 
-int remove_pid(int *bg_pids, int *bg_count, int pid) {
-  for (int i = 0; i < *bg_count; i++) {
-    if (bg_pids[i] == pid) {
-      // Shift remaining pids left
-      for (int j = i; j < *bg_count - 1; j++) {
-        bg_pids[j] = bg_pids[j + 1];
-      }
-      (*bg_count)--;
-      return 1;  // removed
+// Forks and execs a background service
+void start_service(struct service *svc) {
+  bflush(&console);
+  int pid = fork();
+  if (pid < 0) {
+    bprintf(&console, "init: fork failed for %s\n", svc->argv[0]);
+    svc->state = SVC_FAILED;
+    svc->pid = -1;
+    return;
+  }
+  if (pid == 0) {
+    close_control_fds();
+    exec(svc->argv[0], svc->argv);
+    printf("init: exec %s failed\n", svc->argv[0]);
+    exit(1);
+  }
+  svc->state = SVC_RUNNING;
+  svc->pid = pid;
+  svc->started = uptime();
+  pid_insert(pid, svc);
+}
+
+// Schedules a restart after delay ticks
+// init must keep reaping meanwhile, so the delay is slept out by a child
+// whose exit is picked up by the same wait() loop as the services.
+void start_restart_timer(struct service *svc, int delay) {
+  bflush(&console);
+  int pid = fork();
+  if (pid == 0) {
+    sleep(delay);
+    exit(0);
+  }
+  if (pid < 0) {
+    start_service(svc);                    // Cannot wait, restart now
+    return;
+  }
+  svc->state = SVC_BACKOFF;
+  svc->timer_pid = pid;
+  pid_insert(pid, svc);
+}
+
+// Handles the exit of a background service process
+// Each restart waits RESTART_DELAY ticks, doubling up to RESTART_DELAY_MAX
+// while the service keeps failing; a run that lasts RESTART_WINDOW ticks
+// resets the delay. A service restarted more than RESTART_LIMIT times
+// within RESTART_WINDOW ticks is crash-looping and is given up on.
+void service_exited(struct service *svc, int status) {
+  int wpid = svc->pid;
+  svc->pid = -1;
+  if (svc->state == SVC_STOPPED) {
+    bprintf(&console, "init: background service %s (pid %d) stopped\n", svc->argv[0], wpid);
+    return;
+  }
+  if (svc->state == SVC_RESTARTING) {
+    start_service(svc);
+    return;
+  }
+
+  int now = uptime();
+  if (now - svc->window_start > RESTART_WINDOW) {
+    svc->window_start = now;
+    svc->recent = 0;
+  }
+  if (++svc->recent > RESTART_LIMIT) {
+    svc->state = SVC_FAILED;
+    bprintf(&console, "init: background service %s failed: %d restarts within %d ticks, giving up (%d restarts total)\n",
+            svc->argv[0], svc->recent - 1, RESTART_WINDOW, svc->restarts);
+    return;
+  }
+  if (now - svc->started >= RESTART_WINDOW)
+    svc->delay = RESTART_DELAY;            // Ran long enough to count as healthy
+  svc->restarts++;
+  bprintf(&console, "init: background service %s (pid %d) exited with status %d, restarting in %d ticks (restart %d)\n",
+          svc->argv[0], wpid, status, svc->delay, svc->restarts);
+  start_restart_timer(svc, svc->delay);
+  if (svc->delay < RESTART_DELAY_MAX)
+    svc->delay *= 2;
+}
+
+// Finds a configured background service by command name
+struct service *find_service_name(char *name) {
+  for (struct service *svc = services; svc; svc = svc->next) {
+    if (strcmp(svc->argv[0], name) == 0)
+      return svc;
+  }
+  return 0;
+}
+
+char *state_name(int state) {
+  switch (state) {
+  case SVC_RUNNING: return "running";
+  case SVC_BACKOFF: return "backoff";
+  case SVC_STOPPED: return "stopped";
+  case SVC_FAILED: return "failed";
+  case SVC_RESTARTING: return "restarting";
+  }
+  return "unknown";
+}
+
+// Carries out one control request, writing the reply to out
+void run_control(struct bfile *out, char *cmd, char *name) {
+  struct service *svc = name ? find_service_name(name) : 0;
+
+  if (strcmp(cmd, "status") == 0) {
+    for (svc = services; svc; svc = svc->next) {
+      bprintf(out, "%s %s pid %d restarts %d\n", svc->argv[0], state_name(svc->state),
+              svc->pid, svc->restarts);
+    }
+    return;
+  }
+  if (name == 0 || (strcmp(cmd, "start") != 0 && strcmp(cmd, "stop") != 0 &&
+                    strcmp(cmd, "restart") != 0)) {
+    bprintf(out, "usage: initctl start|stop|restart <name> | status\n");
+    return;
+  }
+  if (svc == 0) {
+    bprintf(out, "%s: no such service\n", name);
+    return;
+  }
+
+  if (strcmp(cmd, "start") == 0) {
+    if (svc->state == SVC_RUNNING || svc->state == SVC_BACKOFF || svc->state == SVC_RESTARTING) {
+      bprintf(out, "%s: already running\n", name);
+      return;
+    }
+    svc->delay = RESTART_DELAY;            // Fresh start after stop or failure
+    svc->recent = 0;
+    svc->window_start = uptime();
+    start_service(svc);
+    bprintf(out, "%s: started (pid %d)\n", name, svc->pid);
+  } else {
+    int restart = cmd[0] == 'r';
+    if (svc->state == SVC_RUNNING || svc->state == SVC_RESTARTING) {
+      svc->state = restart ? SVC_RESTARTING : SVC_STOPPED;
+      kill(svc->pid);                      // Reaping finishes the job
+      bprintf(out, "%s: %s (pid %d)\n", name, restart ? "restarting" : "stopping", svc->pid);
+    } else if (restart) {
+      svc->delay = RESTART_DELAY;
+      svc->recent = 0;
+      svc->window_start = uptime();
+      start_service(svc);                  // A pending restart timer is ignored now
+      bprintf(out, "%s: started (pid %d)\n", name, svc->pid);
+    } else {
+      svc->state = SVC_STOPPED;            // Cancels a pending restart
+      bprintf(out, "%s: stopped\n", name);
     }
   }
-  return 0;  // not found
+}
+
+// Dispatches a reaped pid to the background service it belongs to
+// Returns 1 if the pid was a service or restart timer, 0 otherwise.
+int reap_service(int wpid, int status) {
+  if (wpid == ctl_listener_pid) {
+    ctl_listener_pid = -1;
+    handle_control();
+    if (start_control_listener() < 0)
+      bprintf(&console, "init: cannot start control listener\n");
+    return 1;
+  }
+
+  struct service *svc = pid_lookup(wpid);
+  if (svc == 0)
+    return 0;
+  pid_remove(wpid);
+  if (svc->pid == wpid) {
+    service_exited(svc, status);
+  } else if (svc->timer_pid == wpid) {
+    svc->timer_pid = -1;
+    if (svc->state == SVC_BACKOFF)
+      start_service(svc);
+  }
+  return 1;
+}
+
+// Finds the running background service with the given pid
+struct service *find_service_pid(int pid) {
+  struct service *svc = pid_lookup(pid);
+  if (svc && svc->pid == pid)
+    return svc;                            // Not a restart timer
+  return 0;
+}
+
+// Adds a background service for a config line that split() marked with
+// an unquoted '&', copying its words into the service record
+struct service *add_service(char **argv) {
+  struct service *svc = alloc_service();
+  if (svc == 0) {
+    bprintf(&console, "init: out of memory, ignoring %s\n", argv[0]);
+    return 0;
+  }
+  int len = 0, argc;
+  for (argc = 0; argv[argc]; argc++) {
+    int n = strlen(argv[argc]) + 1;
+    if (len + n > MAXLINE) {
+      bprintf(&console, "init: %s: command too long, extra arguments ignored\n", argv[0]);
+      break;
+    }
+    memmove(svc->line + len, argv[argc], n);
+    svc->argv[argc] = svc->line + len;
+    len += n;
+  }
+  svc->argv[argc] = 0;
+  if (argc == 0) {
+    free_service(svc);
+    return 0;
+  }
+  svc->pid = -1;
+  svc->timer_pid = -1;
+  if (!binary_present(svc->argv[0])) {
+    bprintf(&console, "init: background service %s not found, not starting it\n", svc->argv[0]);
+    svc->state = SVC_FAILED;             // Listed by status, never forked
+  }
+  svc->delay = RESTART_DELAY;
+  svc->window_start = uptime();
+  svc->next = services;
+  services = svc;
+  return svc;
 }
 
 int main(void) {
   int fd;
 
+  bfinit(&console, 1, BF_FULL);
   if (open("console", O_RDWR) < 0) {
     mknod("console", CONSOLE, 0);
     open("console", O_RDWR);
   }
   dup(0);
   dup(0);
+  // Right after the console: needs fd CTL_FD
+  if (setup_control() < 0)
+    bprintf(&console, "init: control channel unavailable\n");
+  else if (start_control_listener() < 0)
+    bprintf(&console, "init: cannot start control listener\n");
 
   fd = open("init.conf", O_RDONLY);
   if (fd < 0) {
-    printf("init: could not open init.conf\n");
+    bprintf(&console, "init: could not open init.conf\n");
+    bflush(&console);
     exit(1);
   }
 
-  char buf[MAXLINE];
+  char *buf;
   char *argv[MAXARGS];
-  int i = 0, n;
 
   int fg_count = 0;
-  int bg_pids[MAX_BG];
-  int bg_count = 0;
 
   // Read commands line by line
-  while ((n = read(fd, &buf[i], 1)) == 1) {
-    if (buf[i] == '\n' || i == MAXLINE - 1) {
-      buf[i] = '\0';
-
-      if (buf[0] != '\0') {
-        int bg = 0;
-        split(buf, argv, &bg);
-
-        // Support kill command: "kill PID"
-        if (argv[0] && strcmp(argv[0], "kill") == 0 && argv[1]) {
-          int kpid = atoi(argv[1]);
-          if (remove_pid(bg_pids, &bg_count, kpid)) {
-            if (kill(kpid) < 0)
-              printf("init: failed to kill pid %d\n", kpid);
-            else
-              printf("init: killed pid %d\n", kpid);
-            
-          } else {
-            printf("init: pid %d not found in background jobs\n", kpid);
-          }
-        } else if (argv[0]) {
-          if (bg) {
-            int pid = fork();
-            if (pid < 0) {
-              printf("init: fork failed for %s\n", argv[0]);
-            } else if (pid == 0) {
-              run_with_restart(argv);
-              exit(0);  // never reached
-            } else {
-              if (bg_count < MAX_BG) {
-                bg_pids[bg_count++] = pid;
-              }
-              printf("init: started background service %s with restart (pid %d)\n", argv[0], pid);
-              
-            }
-          } else {
-            int pid = fork();
-            if (pid < 0) {
-              printf("init: fork failed for %s\n", argv[0]);
-            } else if (pid == 0) {
-              exec(argv[0], argv);
-              printf("init: exec %s failed\n", argv[0]);
-              exit(1);
-            } else {
-              printf("init: started foreground service %s (pid %d)\n", argv[0], pid);
-              fg_count++;
-            }
-          }
+  readlninit(&conf_reader, fd);
+  while ((buf = readln(&conf_reader)) != 0) {
+    if (buf[0] != '\0') {
+      int bg = 0;
+      split(buf, argv, &bg);                 // A quoted '&' is part of a word
+      if (bg) {
+        struct service *svc = argv[0] ? add_service(argv) : 0;
+        if (svc && svc->state != SVC_FAILED) {
+          start_service(svc);
+          if (svc->pid > 0)
+            bprintf(&console, "init: started background service %s with restart (pid %d)\n", svc->argv[0], svc->pid);
+        }
+        continue;
+      }
+
+      // Support kill command: "kill PID"
+      if (argv[0] && strcmp(argv[0], "kill") == 0 && argv[1]) {
+        int kpid = atoi(argv[1]);
+        struct service *svc = find_service_pid(kpid);
+        if (svc) {
+          svc->state = SVC_STOPPED;            // Do not restart it
+          if (kill(kpid) < 0)
+            bprintf(&console, "init: failed to kill pid %d\n", kpid);
+          else
+            bprintf(&console, "init: killed pid %d\n", kpid);
+          
+        } else {
+          bprintf(&console, "init: pid %d not found in background jobs\n", kpid);
+        }
+      } else if (argv[0] && !binary_present(argv[0])) {
+        bprintf(&console, "init: %s not found\n", argv[0]);
+      } else if (argv[0]) {
+        bflush(&console);
+        int pid = fork();
+        if (pid < 0) {
+          bprintf(&console, "init: fork failed for %s\n", argv[0]);
+        } else if (pid == 0) {
+          close_control_fds();
+          exec(argv[0], argv);
+          printf("init: exec %s failed\n", argv[0]);
+          exit(1);
+        } else {
+          bprintf(&console, "init: started foreground service %s (pid %d)\n", argv[0], pid);
+          fg_count++;
         }
       }
-      i = 0;
-    } else {
-      i++;
     }
   }
 
   close(fd);
 
-  // Wait for all foreground children to finish
+  // Wait for all foreground children to finish, restarting background
+  // services that exit meanwhile
   int fg_remaining = fg_count;
   while (fg_remaining > 0) {
     int status;
+    bflush(&console);
     int wpid = wait(&status);
-    if (wpid > 0) {
-      printf("init: foreground process %d exited with status %d\n", wpid, status);
+    if (wpid > 0 && !reap_service(wpid, status)) {
+      bprintf(&console, "init: foreground process %d exited with status %d\n", wpid, status);
       fg_remaining--;
     }
   }
-  printf("init: launching fallback shell\n");
+  bprintf(&console, "init: launching fallback shell\n");
   // Fallback shell loop
   while (1) {
+    bflush(&console);
     int pid = fork();
     if (pid == 0) {
       char *sh_argv[] = {"sh", 0};
+      close_control_fds();
       exec("sh", sh_argv);
       printf("init: exec sh failed\n");
       exit(1);
     }
 
     int status;
-    int wpid = wait(&status);
+    int wpid;
+    for (;;) {
+      bflush(&console);
+      if ((wpid = wait(&status)) == pid || wpid < 0)
+        break;
+      reap_service(wpid, status);
+    }
     if (wpid == pid) {
-      printf("init: fallback shell (pid %d) exited with status %d\n", wpid, status);
-    } else if (wpid > 0) {
-    
+      bprintf(&console, "init: fallback shell (pid %d) exited with status %d\n", wpid, status);
     }
   }
 
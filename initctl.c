@@ -0,0 +1,97 @@
+// initctl: controls init's background services at runtime
+//
+//   initctl status
+//   initctl start|stop|restart <name>
+//   initctl reload          (dependency init: apply changes to init.conf)
+//   initctl shutdown        (dependency init: stop all services and halt)
+//
+// The request is written to the control pipe that init leaves open on
+// CTL_FD in every process. init replies in /initctl.<pid>.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+#include "user/ctlchan.h"
+
+#define CTL_TIMEOUT 100          // Ticks to wait for a reply
+
+// Appends the decimal form of n to buf at *len
+void append_int(char *buf, int *len, int n) {
+  char digits[12];
+  int d = 0;
+  do {
+    digits[d++] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0 && d < sizeof(digits));
+  while (d > 0)
+    buf[(*len)++] = digits[--d];
+}
+
+// Appends s to buf at *len
+void append_str(char *buf, int *len, char *s) {
+  while (*s)
+    buf[(*len)++] = *s++;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || (strcmp(argv[1], "status") != 0 && strcmp(argv[1], "reload") != 0 &&
+                    strcmp(argv[1], "shutdown") != 0 && argc < 3)) {
+    fprintf(2, "usage: initctl start|stop|restart <name> | status | reload | shutdown\n");
+    exit(1);
+  }
+  if (strlen(argv[1]) > 16 || (argc > 2 && strlen(argv[2]) > 32)) {
+    fprintf(2, "initctl: argument too long\n");
+    exit(1);
+  }
+
+  // A pipe has no inode, so fstat() only succeeds if CTL_FD is something else
+  struct stat st;
+  if (fstat(CTL_FD, &st) == 0) {
+    fprintf(2, "initctl: no control channel (not started by init?)\n");
+    exit(1);
+  }
+
+  int pid = getpid();
+  char path[24];
+  int len = 0;
+  append_str(path, &len, "/initctl.");
+  append_int(path, &len, pid);
+  path[len] = 0;
+  unlink(path);                            // Stale reply from a reused pid
+
+  // One write, so the request reaches init in one piece
+  char req[CTL_MAXREQ];
+  len = 0;
+  append_int(req, &len, pid);
+  append_str(req, &len, " ");
+  append_str(req, &len, argv[1]);
+  if (argc > 2) {
+    append_str(req, &len, " ");
+    append_str(req, &len, argv[2]);
+  }
+  append_str(req, &len, "\n");
+  if (write(CTL_FD, req, len) != len) {
+    fprintf(2, "initctl: no control channel (not started by init?)\n");
+    exit(1);
+  }
+
+  int fd = -1;
+  for (int waited = 0; waited < CTL_TIMEOUT; waited++) {
+    if ((fd = open(path, O_RDONLY)) >= 0)
+      break;
+    sleep(1);
+  }
+  if (fd < 0) {
+    fprintf(2, "initctl: no reply from init\n");
+    exit(1);
+  }
+
+  char buf[128];
+  int n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    write(1, buf, n);
+  close(fd);
+  unlink(path);
+  exit(0);
+}